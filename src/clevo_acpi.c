@@ -20,23 +20,31 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/acpi.h>
+#include <linux/ktime.h>
 #include "clevo_interfaces.h"
+#include "tuxedo_trace.h"
 
 #define DRIVER_NAME			"clevo_acpi"
 
 struct clevo_acpi_driver_data_t {
 	struct acpi_device *adev;
 	struct clevo_interface_t *clevo_interface;
+	acpi_handle handle;
+	guid_t dsm_guid;
+	// Prebuilt _DSM arguments (uuid, revision, function, package)
+	union acpi_object dsm_args[4];
 };
 
 static struct clevo_acpi_driver_data_t *active_driver_data = NULL;
 
-static u32 clevo_acpi_evaluate(struct acpi_device *device, u8 cmd, u32 arg, u32 *result)
+#ifdef DEBUG
+/**
+ * _DSM call through acpi_evaluate_dsm(), reference path for the benchmark
+ */
+static int clevo_acpi_evaluate_dsm(struct clevo_acpi_driver_data_t *driver_data, u8 cmd, u32 arg, u32 *result)
 {
-	u32 status;
-	acpi_handle handle;
+	int status = 0;
 	u64 dsm_rev_dummy = 0x00; // Dummy 0 value since not used
-	u64 dsm_func = cmd;
 	// Integer package data for argument
 	union acpi_object dsm_argv4_package_data[] = {
 		{
@@ -54,42 +62,139 @@ static u32 clevo_acpi_evaluate(struct acpi_device *device, u8 cmd, u32 arg, u32
 
 	union acpi_object *out_obj;
 
-	guid_t clevo_acpi_dsm_uuid;
+	out_obj = acpi_evaluate_dsm(driver_data->handle, &driver_data->dsm_guid, dsm_rev_dummy, cmd, &dsm_argv4);
+	if (!out_obj)
+		return -EIO;
 
-	status = guid_parse(CLEVO_ACPI_DSM_UUID, &clevo_acpi_dsm_uuid);
-	if (status < 0)
-		return -ENOENT;
+	if (out_obj->type == ACPI_TYPE_INTEGER)
+		*result = (u32) out_obj->integer.value;
+	else
+		status = -ENODATA;
 
-	handle = acpi_device_handle(device);
-	if (handle == NULL)
-		return -ENODEV;
+	ACPI_FREE(out_obj);
+
+	return status;
+}
+#endif
+
+/**
+ * _DSM call with prebuilt arguments
+ *
+ * Copies the prebuilt arguments to the stack and lets ACPICA store the
+ * integer result in a caller provided object instead of a returned
+ * allocation. The method has run when the result does not fit, so a
+ * larger (non-integer) result is reported as unknown output rather than
+ * evaluating _DSM a second time.
+ */
+static int clevo_acpi_evaluate_fast(struct clevo_acpi_driver_data_t *driver_data, u8 cmd, u32 arg, u32 *result)
+{
+	union acpi_object args[ARRAY_SIZE(driver_data->dsm_args)];
+	union acpi_object package_data = {
+		.integer.type = ACPI_TYPE_INTEGER,
+		.integer.value = arg
+	};
+	struct acpi_object_list input = {
+		.count = ARRAY_SIZE(args),
+		.pointer = args
+	};
+	union acpi_object out_obj;
+	struct acpi_buffer output = {
+		.length = sizeof(out_obj),
+		.pointer = &out_obj
+	};
+	acpi_status acpi_result;
+
+	memcpy(args, driver_data->dsm_args, sizeof(args));
+	args[2].integer.value = cmd;
+	args[3].package.elements = &package_data;
+
+	acpi_result = acpi_evaluate_object(driver_data->handle, "_DSM", &input, &output);
+	if (acpi_result == AE_BUFFER_OVERFLOW)
+		return -ENODATA;
+	if (ACPI_FAILURE(acpi_result))
+		return -EIO;
+	if (out_obj.type != ACPI_TYPE_INTEGER)
+		return -ENODATA;
+
+	*result = (u32) out_obj.integer.value;
+
+	return 0;
+}
 
-	out_obj = acpi_evaluate_dsm(handle, &clevo_acpi_dsm_uuid, dsm_rev_dummy, dsm_func, &dsm_argv4);
-	if (!out_obj) {
+static u32 clevo_acpi_evaluate(struct clevo_acpi_driver_data_t *driver_data, u8 cmd, u32 arg, u32 *result)
+{
+	int status;
+	u32 value = 0;
+	ktime_t start, hw_time;
+
+	start = ktime_get();
+	status = clevo_acpi_evaluate_fast(driver_data, cmd, arg, &value);
+	hw_time = ktime_sub(ktime_get(), start);
+
+	if (status == -EIO) {
 		pr_err("failed to evaluate _DSM\n");
-		status = -1;
-	} else {
-		if (out_obj->type == ACPI_TYPE_INTEGER) {
-			if (!IS_ERR_OR_NULL(result))
-				*result = (u32) out_obj->integer.value;
-				// pr_debug("evaluate _DSM cmd: %0#4x arg: %0#10x\n", cmd, arg);
-		} else {
-			pr_err("unknown output from _DSM\n");
-			status = -ENODATA;
-		}
+	} else if (status == -ENODATA) {
+		pr_err("unknown output from _DSM\n");
+	} else if (!IS_ERR_OR_NULL(result)) {
+		*result = value;
+		// pr_debug("evaluate _DSM cmd: %0#4x arg: %0#10x\n", cmd, arg);
 	}
 
-	ACPI_FREE(out_obj);
+	trace_clevo_acpi_evaluate(cmd, arg, value, status, ktime_to_ns(hw_time));
 
 	return status;
 }
 
+#ifdef DEBUG
+/*
+ * Microbenchmark, writing N runs N webcam switch reads through each call
+ * path and logs the achieved calls/s
+ */
+static int clevo_acpi_bench_set(const char *val, const struct kernel_param *kp)
+{
+	struct clevo_acpi_driver_data_t *driver_data = active_driver_data;
+	unsigned int count, i, path;
+	u32 result;
+	u64 start, ns;
+	int err;
+
+	err = kstrtouint(val, 0, &count);
+	if (err)
+		return err;
+	if (IS_ERR_OR_NULL(driver_data))
+		return -ENODEV;
+
+	for (path = 0; path < 2; ++path) {
+		start = ktime_get_ns();
+		for (i = 0; i < count; ++i) {
+			if (path == 0)
+				clevo_acpi_evaluate_fast(driver_data, CLEVO_CMD_GET_WEBCAM_SW, 0, &result);
+			else
+				clevo_acpi_evaluate_dsm(driver_data, CLEVO_CMD_GET_WEBCAM_SW, 0, &result);
+		}
+		ns = ktime_get_ns() - start;
+		pr_info("bench %s: %u calls in %llu ns, %llu calls/s\n",
+			path == 0 ? "prebuilt" : "acpi_evaluate_dsm", count, ns,
+			ns ? div64_u64((u64) count * NSEC_PER_SEC, ns) : 0);
+	}
+
+	return 0;
+}
+
+static const struct kernel_param_ops param_ops_bench = {
+	.set = clevo_acpi_bench_set,
+};
+
+module_param_cb(bench, &param_ops_bench, NULL, S_IWUSR);
+MODULE_PARM_DESC(bench, "Run N _DSM reads on each call path and log calls/s");
+#endif
+
 u32 clevo_acpi_interface_method_call(u8 cmd, u32 arg, u32 *result_value)
 {
 	u32 status = 0;
 
 	if (!IS_ERR_OR_NULL(active_driver_data)) {
-		status = clevo_acpi_evaluate(active_driver_data->adev, cmd, arg, result_value);
+		status = clevo_acpi_evaluate(active_driver_data, cmd, arg, result_value);
 	} else {
 		pr_err("acpi method call exec, no driver data found\n");
 		pr_err("..for method_call: %0#4x arg: %0#10x\n", cmd, arg);
@@ -116,6 +221,23 @@ static int clevo_acpi_add(struct acpi_device *device)
 	driver_data->adev = device;
 	driver_data->clevo_interface = &clevo_acpi_interface;
 
+	// Resolve everything constant across _DSM calls once
+	driver_data->handle = acpi_device_handle(device);
+	if (driver_data->handle == NULL)
+		return -ENODEV;
+	if (guid_parse(CLEVO_ACPI_DSM_UUID, &driver_data->dsm_guid) < 0)
+		return -ENOENT;
+
+	driver_data->dsm_args[0].buffer.type = ACPI_TYPE_BUFFER;
+	driver_data->dsm_args[0].buffer.length = sizeof(driver_data->dsm_guid);
+	driver_data->dsm_args[0].buffer.pointer = (u8 *) &driver_data->dsm_guid;
+	driver_data->dsm_args[1].integer.type = ACPI_TYPE_INTEGER;
+	driver_data->dsm_args[1].integer.value = 0x00; // Revision, not used
+	driver_data->dsm_args[2].integer.type = ACPI_TYPE_INTEGER;
+	driver_data->dsm_args[3].package.type = ACPI_TYPE_PACKAGE;
+	driver_data->dsm_args[3].package.count = 1;
+
+	device->driver_data = driver_data;
 	active_driver_data = driver_data;
 
 	pr_debug("clevo_acpi driver add\n");
@@ -138,13 +260,13 @@ static int clevo_acpi_remove(struct acpi_device *device)
 
 void clevo_acpi_notify(struct acpi_device *device, u32 event)
 {
-	u32 event_value;
-	// struct clevo_acpi_driver_data_t *clevo_acpi_driver_data;
+	u32 event_value = 0;
+	struct clevo_acpi_driver_data_t *driver_data = acpi_driver_data(device);
 
-	clevo_acpi_evaluate(device, 0x01, 0, &event_value);
+	if (!IS_ERR_OR_NULL(driver_data))
+		clevo_acpi_evaluate(driver_data, 0x01, 0, &event_value);
 	pr_debug("clevo_acpi event: %0#6x, clevo event value: %0#6x\n", event, event_value);
 
-	// clevo_acpi_driver_data = container_of(&device, struct clevo_acpi_driver_data_t, adev);
 	if (!IS_ERR_OR_NULL(clevo_acpi_interface.event_callb)) {
 		// Execute registered callback
 		clevo_acpi_interface.event_callb(event);
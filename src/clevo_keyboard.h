@@ -18,6 +18,13 @@
  */
 #include "tuxedo_keyboard_common.h"
 #include "clevo_interfaces.h"
+#include "tuxedo_trace.h"
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+#include <linux/led-class-multicolor.h>
+#endif
 
 #define BRIGHTNESS_MIN                  0
 #define BRIGHTNESS_MAX                  255
@@ -234,6 +241,40 @@ static struct kbd_led_state_t kbd_led_state = {
 	.whole_kbd_color = 7
 };
 
+/*
+ * Hardware state diff
+ *
+ * kbd_led_state is the desired state, kbd_led_hw_state the state last
+ * committed to the firmware. Only fields with their bit set in
+ * kbd_led_hw_valid are known, a commit only issues commands for fields
+ * that are unknown or differ. Both are protected by kbd_led_state_lock.
+ */
+#define KB_LED_ENABLED		BIT(0)
+#define KB_LED_BRIGHTNESS	BIT(1)
+#define KB_LED_PATTERN		BIT(2)
+#define KB_LED_COLOR_LEFT	BIT(3)
+#define KB_LED_COLOR_CENTER	BIT(4)
+#define KB_LED_COLOR_RIGHT	BIT(5)
+#define KB_LED_COLOR_EXTRA	BIT(6)
+#define KB_LED_COLORS		(KB_LED_COLOR_LEFT | KB_LED_COLOR_CENTER | \
+				 KB_LED_COLOR_RIGHT | KB_LED_COLOR_EXTRA)
+
+static struct kbd_led_state_t kbd_led_hw_state;
+static u32 kbd_led_hw_valid;
+static DEFINE_MUTEX(kbd_led_state_lock);
+
+static bool param_led_state_cache = true;
+module_param_named(led_state_cache, param_led_state_cache, bool, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(led_state_cache, "Skip keyboard backlight commands for unchanged state (default: true)");
+
+static ulong led_cmds_issued;
+module_param(led_cmds_issued, ulong, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(led_cmds_issued, "Keyboard backlight commands sent to the firmware (read-only)");
+
+static ulong led_cmds_elided;
+module_param(led_cmds_elided, ulong, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(led_cmds_elided, "Keyboard backlight commands skipped as unchanged (read-only)");
+
 static struct blinking_pattern_t blinking_patterns[] = {
         { .key = 0,.value = 0,.name = "CUSTOM"},
         { .key = 1,.value = 0x1002a000,.name = "BREATHE"},
@@ -304,11 +345,26 @@ static ssize_t show_hasextra_fs(struct device *child,
 
 u32 clevo_evaluate_method(u8 cmd, u32 arg, u32 *result)
 {
+	u32 status, value = 0;
+	ktime_t start;
+
 	if (IS_ERR_OR_NULL(active_clevo_interface)) {
 		pr_err("clevo_keyboard: no active interface while attempting cmd %02x arg %08x\n", cmd, arg);
 		return -ENODEV;
 	}
-	return active_clevo_interface->method_call(cmd, arg, result);
+
+	if (!IS_ERR_OR_NULL(result))
+		value = *result;
+
+	start = ktime_get();
+	status = active_clevo_interface->method_call(cmd, arg, &value);
+	trace_clevo_evaluate_method(cmd, arg, value, (int)status,
+				    ktime_to_ns(ktime_sub(ktime_get(), start)));
+
+	if (!IS_ERR_OR_NULL(result))
+		*result = value;
+
+	return status;
 }
 EXPORT_SYMBOL(clevo_evaluate_method);
 
@@ -324,13 +380,193 @@ u32 clevo_get_active_interface_id(char **id_str)
 }
 EXPORT_SYMBOL(clevo_get_active_interface_id);
 
-static void set_brightness(u8 brightness)
+static u32 set_enabled_arg(u8 state)
 {
-	TUXEDO_INFO("Set brightness on %d", brightness);
-	if (!clevo_evaluate_method
-	    (CLEVO_METHOD_ID_SET_KB_LEDS, 0xF4000000 | brightness, NULL)) {
-		kbd_led_state.brightness = brightness;
+	u32 cmd = 0xE0000000;
+
+	if (state == 0) {
+		cmd |= 0x003001;
+	} else {
+		cmd |= 0x07F001;
 	}
+
+	return cmd;
+}
+
+static u32 set_color_arg(u32 region, u32 color)
+{
+	u32 cset =
+	    ((color & 0x0000FF) << 16) | ((color & 0xFF0000) >> 8) |
+	    ((color & 0x00FF00) >> 8);
+
+	return region | cset;
+}
+
+/**
+ * Issue one keyboard LED command and record whether the field is now known
+ */
+static int kbd_led_write(u32 field, u32 arg)
+{
+	int status = clevo_evaluate_method(CLEVO_METHOD_ID_SET_KB_LEDS, arg, NULL);
+
+	led_cmds_issued++;
+	if (status)
+		kbd_led_hw_valid &= ~field;
+	else
+		kbd_led_hw_valid |= field;
+
+	return status;
+}
+
+/**
+ * True if the field is known to already hold the desired value
+ */
+static bool kbd_led_unchanged(u32 field, bool equal)
+{
+	if ((kbd_led_hw_valid & field) && equal) {
+		led_cmds_elided++;
+		return true;
+	}
+
+	return false;
+}
+
+static void kbd_led_commit_enabled(void)
+{
+	if (kbd_led_unchanged(KB_LED_ENABLED, kbd_led_hw_state.enabled == kbd_led_state.enabled))
+		return;
+
+	TUXEDO_INFO("Set keyboard enabled to: %d\n", kbd_led_state.enabled);
+	if (!kbd_led_write(KB_LED_ENABLED, set_enabled_arg(kbd_led_state.enabled)))
+		kbd_led_hw_state.enabled = kbd_led_state.enabled;
+}
+
+static void kbd_led_commit_color(u32 field, u32 region, u32 *hw_color, u32 color)
+{
+	if (kbd_led_unchanged(field, *hw_color == color))
+		return;
+
+	TUXEDO_DEBUG("Set Color '%08x' for region '%08x'", color, region);
+	if (!kbd_led_write(field, set_color_arg(region, color)))
+		*hw_color = color;
+}
+
+/**
+ * Bring the hardware to kbd_led_state for the given fields, caller has
+ * to hold kbd_led_state_lock
+ *
+ * Order: switching off first and on last so that intermediate states are
+ * not visible, pattern before colors since the firmware replaces the
+ * colors on pattern changes.
+ */
+static void kbd_led_commit(u32 fields)
+{
+	u8 pattern = kbd_led_state.blinking_pattern;
+
+	if (!param_led_state_cache)
+		kbd_led_hw_valid = 0;
+
+	if ((fields & KB_LED_ENABLED) && !kbd_led_state.enabled)
+		kbd_led_commit_enabled();
+
+	if ((fields & KB_LED_PATTERN)
+	    && !kbd_led_unchanged(KB_LED_PATTERN, kbd_led_hw_state.blinking_pattern == pattern)) {
+		TUXEDO_INFO("set_mode on %s", blinking_patterns[pattern].name);
+		if (!kbd_led_write(KB_LED_PATTERN, blinking_patterns[pattern].value))
+			kbd_led_hw_state.blinking_pattern = pattern;
+		kbd_led_hw_valid &= ~KB_LED_COLORS;
+	}
+
+	if (fields & KB_LED_COLOR_LEFT)
+		kbd_led_commit_color(KB_LED_COLOR_LEFT, REGION_LEFT,
+				     &kbd_led_hw_state.color.left, kbd_led_state.color.left);
+	if (fields & KB_LED_COLOR_CENTER)
+		kbd_led_commit_color(KB_LED_COLOR_CENTER, REGION_CENTER,
+				     &kbd_led_hw_state.color.center, kbd_led_state.color.center);
+	if (fields & KB_LED_COLOR_RIGHT)
+		kbd_led_commit_color(KB_LED_COLOR_RIGHT, REGION_RIGHT,
+				     &kbd_led_hw_state.color.right, kbd_led_state.color.right);
+	if ((fields & KB_LED_COLOR_EXTRA) && kbd_led_state.has_extra == 1)
+		kbd_led_commit_color(KB_LED_COLOR_EXTRA, REGION_EXTRA,
+				     &kbd_led_hw_state.color.extra, kbd_led_state.color.extra);
+
+	if ((fields & KB_LED_BRIGHTNESS)
+	    && !kbd_led_unchanged(KB_LED_BRIGHTNESS, kbd_led_hw_state.brightness == kbd_led_state.brightness)) {
+		TUXEDO_INFO("Set brightness on %d", kbd_led_state.brightness);
+		if (!kbd_led_write(KB_LED_BRIGHTNESS, KEYBOARD_BRIGHTNESS | kbd_led_state.brightness))
+			kbd_led_hw_state.brightness = kbd_led_state.brightness;
+	}
+
+	if ((fields & KB_LED_ENABLED) && kbd_led_state.enabled)
+		kbd_led_commit_enabled();
+}
+
+/*
+ * Write-behind
+ *
+ * With write_behind set, state changes only update kbd_led_state and mark
+ * the fields pending. A flush worker, started at most write_behind_max_hz
+ * times per second, commits the newest state of all pending fields, so
+ * values superseded in the meantime never reach the firmware.
+ */
+static bool param_write_behind = false;
+module_param_named(write_behind, param_write_behind, bool, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(write_behind, "Apply keyboard backlight changes asynchronously (default: false)");
+
+static uint param_write_behind_max_hz = 50;
+module_param_named(write_behind_max_hz, param_write_behind_max_hz, uint, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(write_behind_max_hz, "Maximum write-behind flushes per second, 0 = unlimited (default: 50)");
+
+static ulong led_cmds_superseded;
+module_param(led_cmds_superseded, ulong, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(led_cmds_superseded, "Keyboard backlight changes replaced before being flushed (read-only)");
+
+static u32 kbd_led_pending;
+static unsigned long kbd_led_last_flush;
+
+static void kbd_led_flush_work_func(struct work_struct *work)
+{
+	mutex_lock(&kbd_led_state_lock);
+	kbd_led_commit(kbd_led_pending);
+	kbd_led_pending = 0;
+	kbd_led_last_flush = jiffies;
+	mutex_unlock(&kbd_led_state_lock);
+}
+
+static DECLARE_DELAYED_WORK(kbd_led_flush_work, kbd_led_flush_work_func);
+
+static void kbd_anim_stop(void);
+
+/**
+ * Commit the fields now or, in write-behind mode, schedule the flush,
+ * caller has to hold kbd_led_state_lock
+ */
+static void kbd_led_apply(u32 fields)
+{
+	unsigned long next;
+
+	if (!param_write_behind) {
+		kbd_led_commit(fields);
+		return;
+	}
+
+	led_cmds_superseded += hweight32(kbd_led_pending & fields);
+	kbd_led_pending |= fields;
+
+	next = kbd_led_last_flush;
+	if (param_write_behind_max_hz > 0)
+		next += HZ / param_write_behind_max_hz;
+
+	// Does nothing if already scheduled, the pending flush picks it up
+	schedule_delayed_work(&kbd_led_flush_work, time_after(next, jiffies) ? next - jiffies : 0);
+}
+
+static void set_brightness(u8 brightness)
+{
+	mutex_lock(&kbd_led_state_lock);
+	kbd_led_state.brightness = brightness;
+	kbd_led_apply(KB_LED_BRIGHTNESS);
+	mutex_unlock(&kbd_led_state_lock);
 }
 
 static ssize_t set_brightness_fs(struct device *child,
@@ -351,25 +587,12 @@ static ssize_t set_brightness_fs(struct device *child,
 	return size;
 }
 
-static int set_enabled_cmd(u8 state)
-{
-	u32 cmd = 0xE0000000;
-	TUXEDO_INFO("Set keyboard enabled to: %d\n", state);
-
-	if (state == 0) {
-		cmd |= 0x003001;
-	} else {
-		cmd |= 0x07F001;
-	}
-
-	return clevo_evaluate_method(CLEVO_METHOD_ID_SET_KB_LEDS, cmd, NULL);
-}
-
 static void set_enabled(u8 state)
 {
-	if (!set_enabled_cmd(state)) {
-		kbd_led_state.enabled = state;
-	}
+	mutex_lock(&kbd_led_state_lock);
+	kbd_led_state.enabled = state;
+	kbd_led_apply(KB_LED_ENABLED);
+	mutex_unlock(&kbd_led_state_lock);
 }
 
 static ssize_t set_state_fs(struct device *child, struct device_attribute *attr,
@@ -391,38 +614,32 @@ static ssize_t set_state_fs(struct device *child, struct device_attribute *attr,
 
 static int set_color(u32 region, u32 color)
 {
-	u32 cset =
-	    ((color & 0x0000FF) << 16) | ((color & 0xFF0000) >> 8) |
-	    ((color & 0x00FF00) >> 8);
-	u32 clevo_submethod_arg = region | cset;
-
 	TUXEDO_DEBUG("Set Color '%08x' for region '%08x'", color, region);
 
-	return clevo_evaluate_method(CLEVO_METHOD_ID_SET_KB_LEDS, clevo_submethod_arg, NULL);
+	return clevo_evaluate_method(CLEVO_METHOD_ID_SET_KB_LEDS, set_color_arg(region, color), NULL);
 }
-static int set_color_code_region(u32 region, u32 colorcode)
+
+/**
+ * Desired color field for a region, caller has to hold kbd_led_state_lock
+ */
+static u32 set_color_region_state(u32 region, u32 colorcode)
 {
-	int err;
-	if (0 == (err = set_color(region, colorcode))) {
-		// after succesfully setting color, update our state struct
-		// depending on which region was changed
-		switch (region) {
-		case REGION_LEFT:
-			kbd_led_state.color.left = colorcode;
-			break;
-		case REGION_CENTER:
-			kbd_led_state.color.center = colorcode;
-			break;
-		case REGION_RIGHT:
-			kbd_led_state.color.right = colorcode;
-			break;
-		case REGION_EXTRA:
-			kbd_led_state.color.extra = colorcode;
-			break;
-		}
+	switch (region) {
+	case REGION_LEFT:
+		kbd_led_state.color.left = colorcode;
+		return KB_LED_COLOR_LEFT;
+	case REGION_CENTER:
+		kbd_led_state.color.center = colorcode;
+		return KB_LED_COLOR_CENTER;
+	case REGION_RIGHT:
+		kbd_led_state.color.right = colorcode;
+		return KB_LED_COLOR_RIGHT;
+	case REGION_EXTRA:
+		kbd_led_state.color.extra = colorcode;
+		return KB_LED_COLOR_EXTRA;
 	}
 
-	return err;
+	return 0;
 }
 
 static int set_color_string_region(const char *color_string, size_t size, u32 region)
@@ -434,24 +651,10 @@ static int set_color_string_region(const char *color_string, size_t size, u32 re
 		return err;
 	}
 
-	if (!set_color(region, colorcode)) {
-		// after succesfully setting color, update our state struct
-		// depending on which region was changed
-		switch (region) {
-		case REGION_LEFT:
-			kbd_led_state.color.left = colorcode;
-			break;
-		case REGION_CENTER:
-			kbd_led_state.color.center = colorcode;
-			break;
-		case REGION_RIGHT:
-			kbd_led_state.color.right = colorcode;
-			break;
-		case REGION_EXTRA:
-			kbd_led_state.color.extra = colorcode;
-			break;
-		}
-	}
+	kbd_anim_stop();
+	mutex_lock(&kbd_led_state_lock);
+	kbd_led_apply(set_color_region_state(region, colorcode));
+	mutex_unlock(&kbd_led_state_lock);
 
 	return size;
 }
@@ -500,36 +703,359 @@ static int set_next_color_whole_kb(void)
 		    new_color_id, new_color_code);
 
 	/* Set color on all four regions*/
-	set_color_code_region(REGION_LEFT,   new_color_code);
-	set_color_code_region(REGION_CENTER, new_color_code);
-	set_color_code_region(REGION_RIGHT,  new_color_code);
-	set_color_code_region(REGION_EXTRA,  new_color_code);
+	kbd_anim_stop();
+	mutex_lock(&kbd_led_state_lock);
+	kbd_led_state.color.left = new_color_code;
+	kbd_led_state.color.center = new_color_code;
+	kbd_led_state.color.right = new_color_code;
+	kbd_led_state.color.extra = new_color_code;
+	kbd_led_apply(KB_LED_COLORS);
 
 	kbd_led_state.whole_kbd_color = new_color_id;
+	mutex_unlock(&kbd_led_state_lock);
 
 	return 0;
 }
 
+/**
+ * Fields written by a full state write, caller has to hold kbd_led_state_lock
+ */
+static u32 kbd_led_pattern_fields(void)
+{
+	// 0 is the "custom" blinking pattern, only then the stored colors apply
+	if (kbd_led_state.blinking_pattern == 0)
+		return KB_LED_PATTERN | KB_LED_COLORS;
+
+	return KB_LED_PATTERN;
+}
+
 static void set_blinking_pattern(u8 blinkling_pattern)
 {
-	TUXEDO_INFO("set_mode on %s", blinking_patterns[blinkling_pattern].name);
+	kbd_anim_stop();
+	mutex_lock(&kbd_led_state_lock);
+	kbd_led_state.blinking_pattern = blinkling_pattern;
+	kbd_led_apply(kbd_led_pattern_fields());
+	mutex_unlock(&kbd_led_state_lock);
+}
+
+/*
+ * Keyframe animation engine
+ *
+ * Plays a keyframe sequence uploaded through the "animation" binary
+ * attribute on the custom pattern. Frames are paced by an hrtimer on
+ * absolute deadlines and rendered from a work item, since the firmware
+ * calls sleep. Each frame only sends the regions whose color changed.
+ * Frames whose deadline has passed by a full period are dropped, frames
+ * taking longer than the period to render are counted as overruns.
+ *
+ * Upload format: struct kb_anim_header_t followed by header.keyframes
+ * times struct kb_anim_keyframe_t, little endian, in one write. A
+ * header with keyframes = 0 stops the animation, as does any write to
+ * the colors or the blinking pattern.
+ */
+#define KB_ANIM_MAX_KEYFRAMES		64
+#define KB_ANIM_FRAME_MS_DEFAULT	33
+#define KB_ANIM_FRAME_MS_MIN		10
+
+#define KB_ANIM_FLAG_LOOP		BIT(0)
+
+#define KB_ANIM_INTERP_STEP		0
+#define KB_ANIM_INTERP_LINEAR		1
+
+struct kb_anim_header_t {
+	u16 keyframes;
+	u16 flags;
+	u16 frame_ms;			// 0 = default
+	u16 reserved;
+} __packed;
+
+struct kb_anim_keyframe_t {
+	u32 color[4];			// left, center, right, extra (0xRRGGBB)
+	u16 duration_ms;		// Time until the next keyframe
+	u8 interpolation;		// Towards the next keyframe
+	u8 reserved;
+} __packed;
+
+static struct {
+	struct kb_anim_keyframe_t *keyframes;
+	u16 count;
+	u16 flags;
+	u32 total_ms;
+	u64 period_ns;
+	ktime_t start;
+	ktime_t deadline;
+	bool running;
+
+	u64 frames;
+	u64 dropped;
+	u64 overruns;
+	u64 max_render_ns;
+
+	struct hrtimer timer;
+	struct work_struct work;
+} kbd_anim;
+
+static u32 kbd_anim_blend(u32 from, u32 to, u32 pos, u32 len)
+{
+	u32 result = 0;
+	int shift, a, b;
 
-	if (!clevo_evaluate_method(CLEVO_METHOD_ID_SET_KB_LEDS, blinking_patterns[blinkling_pattern].value, NULL)) {
-		// method was succesfull so update ur internal state struct
-		kbd_led_state.blinking_pattern = blinkling_pattern;
+	for (shift = 0; shift <= 16; shift += 8) {
+		a = (from >> shift) & 0xff;
+		b = (to >> shift) & 0xff;
+		result |= (u32) (a + (b - a) * (int) pos / (int) len) << shift;
 	}
 
-	if (blinkling_pattern == 0) {  // 0 is the "custom" blinking pattern
+	return result;
+}
+
+/**
+ * Set kbd_led_state colors for the time since start, caller has to hold
+ * kbd_led_state_lock. Returns false once a non looping animation ended.
+ */
+static bool kbd_anim_render(u64 elapsed_ms)
+{
+	const struct kb_anim_keyframe_t *frame, *next;
+	u32 colors[4], pos, rem;
+	int i;
+
+	if (kbd_anim.flags & KB_ANIM_FLAG_LOOP) {
+		div_u64_rem(elapsed_ms, kbd_anim.total_ms, &rem);
+		elapsed_ms = rem;
+	}
 
-		// so just set all regions to the stored colors
-		set_color(REGION_LEFT, kbd_led_state.color.left);
-		set_color(REGION_CENTER, kbd_led_state.color.center);
-		set_color(REGION_RIGHT, kbd_led_state.color.right);
+	for (i = 0; i < kbd_anim.count - 1; ++i) {
+		if (elapsed_ms < kbd_anim.keyframes[i].duration_ms)
+			break;
+		elapsed_ms -= kbd_anim.keyframes[i].duration_ms;
+	}
+
+	frame = &kbd_anim.keyframes[i];
+	if (i < kbd_anim.count - 1)
+		next = &kbd_anim.keyframes[i + 1];
+	else if (kbd_anim.flags & KB_ANIM_FLAG_LOOP)
+		next = &kbd_anim.keyframes[0];
+	else
+		next = frame;
+
+	pos = min_t(u64, elapsed_ms, frame->duration_ms);
+	for (i = 0; i < ARRAY_SIZE(colors); ++i) {
+		if (frame->interpolation == KB_ANIM_INTERP_LINEAR && frame->duration_ms > 0)
+			colors[i] = kbd_anim_blend(frame->color[i], next->color[i], pos, frame->duration_ms);
+		else
+			colors[i] = frame->color[i];
+	}
+
+	kbd_led_state.color.left = colors[0];
+	kbd_led_state.color.center = colors[1];
+	kbd_led_state.color.right = colors[2];
+	kbd_led_state.color.extra = colors[3];
+
+	return (kbd_anim.flags & KB_ANIM_FLAG_LOOP) || next != frame || pos < frame->duration_ms;
+}
+
+static void kbd_anim_work_handler(struct work_struct *work)
+{
+	ktime_t now, render_start;
+	u64 late_ns, render_ns, missed;
+	bool more;
+
+	mutex_lock(&kbd_led_state_lock);
+	if (!kbd_anim.running) {
+		mutex_unlock(&kbd_led_state_lock);
+		return;
+	}
+
+	// Skip frames whose deadline has already passed
+	now = ktime_get();
+	late_ns = ktime_after(now, kbd_anim.deadline) ? ktime_to_ns(ktime_sub(now, kbd_anim.deadline)) : 0;
+	missed = div64_u64(late_ns, kbd_anim.period_ns);
+	kbd_anim.dropped += missed;
+	kbd_anim.deadline = ktime_add_ns(kbd_anim.deadline, (missed + 1) * kbd_anim.period_ns);
+
+	render_start = ktime_get();
+	more = kbd_anim_render(ktime_ms_delta(render_start, kbd_anim.start));
+	kbd_led_commit(KB_LED_COLORS);
+	render_ns = ktime_to_ns(ktime_sub(ktime_get(), render_start));
+
+	kbd_anim.frames++;
+	if (render_ns > kbd_anim.period_ns)
+		kbd_anim.overruns++;
+	if (render_ns > kbd_anim.max_render_ns)
+		kbd_anim.max_render_ns = render_ns;
+
+	kbd_anim.running = more;
+	if (more)
+		hrtimer_start(&kbd_anim.timer, kbd_anim.deadline, HRTIMER_MODE_ABS);
+	mutex_unlock(&kbd_led_state_lock);
+}
+
+static enum hrtimer_restart kbd_anim_timer_handler(struct hrtimer *timer)
+{
+	queue_work(system_highpri_wq, &kbd_anim.work);
+	return HRTIMER_NORESTART;
+}
+
+static void kbd_anim_init(void)
+{
+	if (kbd_anim.timer.function)
+		return;
 
-		if (kbd_led_state.has_extra == 1) {
-			set_color(REGION_EXTRA, kbd_led_state.color.extra);
+	hrtimer_init(&kbd_anim.timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	kbd_anim.timer.function = kbd_anim_timer_handler;
+	INIT_WORK(&kbd_anim.work, kbd_anim_work_handler);
+}
+
+static void kbd_anim_stop(void)
+{
+	struct kb_anim_keyframe_t *keyframes;
+
+	// Not set up before the first probe
+	if (!kbd_anim.timer.function)
+		return;
+
+	mutex_lock(&kbd_led_state_lock);
+	kbd_anim.running = false;
+	mutex_unlock(&kbd_led_state_lock);
+
+	hrtimer_cancel(&kbd_anim.timer);
+	cancel_work_sync(&kbd_anim.work);
+
+	mutex_lock(&kbd_led_state_lock);
+	keyframes = kbd_anim.keyframes;
+	kbd_anim.keyframes = NULL;
+	kbd_anim.count = 0;
+	mutex_unlock(&kbd_led_state_lock);
+
+	kfree(keyframes);
+}
+
+static ssize_t kbd_anim_write(struct file *filp, struct kobject *kobj,
+			      struct bin_attribute *attr, char *buffer,
+			      loff_t offset, size_t size)
+{
+	struct kb_anim_header_t header;
+	struct kb_anim_keyframe_t *keyframes;
+	u32 total_ms = 0;
+	int i;
+
+	if (offset != 0 || size < sizeof(header))
+		return -EINVAL;
+
+	memcpy(&header, buffer, sizeof(header));
+	if (header.keyframes > KB_ANIM_MAX_KEYFRAMES
+	    || size != sizeof(header) + header.keyframes * sizeof(*keyframes))
+		return -EINVAL;
+
+	kbd_anim_stop();
+	if (header.keyframes == 0)
+		return size;
+
+	keyframes = kmemdup(buffer + sizeof(header), header.keyframes * sizeof(*keyframes), GFP_KERNEL);
+	if (!keyframes)
+		return -ENOMEM;
+
+	for (i = 0; i < header.keyframes; ++i) {
+		if (keyframes[i].interpolation > KB_ANIM_INTERP_LINEAR) {
+			kfree(keyframes);
+			return -EINVAL;
 		}
+		total_ms += keyframes[i].duration_ms;
+	}
+	if ((header.flags & KB_ANIM_FLAG_LOOP) && total_ms == 0) {
+		kfree(keyframes);
+		return -EINVAL;
 	}
+
+	if (header.frame_ms == 0)
+		header.frame_ms = KB_ANIM_FRAME_MS_DEFAULT;
+
+	mutex_lock(&kbd_led_state_lock);
+	kbd_anim.keyframes = keyframes;
+	kbd_anim.count = header.keyframes;
+	kbd_anim.flags = header.flags;
+	kbd_anim.total_ms = total_ms;
+	kbd_anim.period_ns = (u64) max_t(u16, header.frame_ms, KB_ANIM_FRAME_MS_MIN) * NSEC_PER_MSEC;
+	kbd_anim.frames = 0;
+	kbd_anim.dropped = 0;
+	kbd_anim.overruns = 0;
+	kbd_anim.max_render_ns = 0;
+
+	// Colors only apply on the custom pattern
+	kbd_led_state.blinking_pattern = 0;
+	kbd_led_commit(KB_LED_PATTERN);
+
+	kbd_anim.start = ktime_get();
+	kbd_anim.deadline = kbd_anim.start;
+	kbd_anim.running = true;
+	queue_work(system_highpri_wq, &kbd_anim.work);
+	mutex_unlock(&kbd_led_state_lock);
+
+	return size;
+}
+
+static ssize_t show_animation_stats_fs(struct device *child,
+				       struct device_attribute *attr, char *buffer)
+{
+	ssize_t len;
+
+	mutex_lock(&kbd_led_state_lock);
+	len = sprintf(buffer, "running=%d keyframes=%u frame_us=%llu frames=%llu dropped=%llu overruns=%llu max_render_us=%llu\n",
+		      kbd_anim.running, kbd_anim.count, div_u64(kbd_anim.period_ns, NSEC_PER_USEC),
+		      kbd_anim.frames, kbd_anim.dropped, kbd_anim.overruns,
+		      div_u64(kbd_anim.max_render_ns, NSEC_PER_USEC));
+	mutex_unlock(&kbd_led_state_lock);
+
+	return len;
+}
+
+// Sysfs Interface for the whole state in one transaction
+// "<left> <center> <right> <extra> <brightness> <mode>", colors as hexvalue
+static ssize_t show_color_scheme_fs(struct device *child,
+				    struct device_attribute *attr, char *buffer)
+{
+	ssize_t len;
+
+	mutex_lock(&kbd_led_state_lock);
+	len = sprintf(buffer, "%06x %06x %06x %06x %d %d\n",
+		      kbd_led_state.color.left, kbd_led_state.color.center,
+		      kbd_led_state.color.right, kbd_led_state.color.extra,
+		      kbd_led_state.brightness, kbd_led_state.blinking_pattern);
+	mutex_unlock(&kbd_led_state_lock);
+
+	return len;
+}
+
+static ssize_t set_color_scheme_fs(struct device *child,
+				   struct device_attribute *attr,
+				   const char *buffer, size_t size)
+{
+	u32 left, center, right, extra;
+	unsigned int brightness, blinking_pattern;
+
+	if (sscanf(buffer, "%x %x %x %x %u %u", &left, &center, &right, &extra,
+		   &brightness, &blinking_pattern) != 6)
+		return -EINVAL;
+
+	if (brightness > BRIGHTNESS_MAX || blinking_pattern >= ARRAY_SIZE(blinking_patterns))
+		return -EINVAL;
+
+	// Colors are 0xRRGGBB
+	if (left > 0xffffff || center > 0xffffff || right > 0xffffff || extra > 0xffffff)
+		return -EINVAL;
+
+	kbd_anim_stop();
+	mutex_lock(&kbd_led_state_lock);
+	kbd_led_state.color.left = left;
+	kbd_led_state.color.center = center;
+	kbd_led_state.color.right = right;
+	kbd_led_state.color.extra = extra;
+	kbd_led_state.brightness = brightness;
+	kbd_led_state.blinking_pattern = blinking_pattern;
+	kbd_led_apply(kbd_led_pattern_fields() | KB_LED_BRIGHTNESS);
+	mutex_unlock(&kbd_led_state_lock);
+
+	return size;
 }
 
 static ssize_t set_blinking_pattern_fs(struct device *child,
@@ -583,6 +1109,8 @@ void clevo_keyboard_event_callb(u32 event)
 
 	// TUXEDO_DEBUG("clevo event: %0#6x\n", event);
 
+	tuxedo_event_notify(TUXEDO_EVENT_SOURCE_CLEVO, event);
+
 	switch (key_event) {
 	case CLEVO_EVENT_DECREASE_BACKLIGHT:
 		if (kbd_led_state.brightness == BRIGHTNESS_MIN
@@ -640,9 +1168,18 @@ static DEVICE_ATTR(color_extra, 0644, show_color_extra_fs, set_color_extra_fs);
 static DEVICE_ATTR(brightness, 0644, show_brightness_fs, set_brightness_fs);
 static DEVICE_ATTR(mode, 0644, show_blinking_patterns_fs, set_blinking_pattern_fs);
 static DEVICE_ATTR(extra, 0444, show_hasextra_fs, NULL);
+static DEVICE_ATTR(animation_stats, 0444, show_animation_stats_fs, NULL);
+static DEVICE_ATTR(color_scheme, 0644, show_color_scheme_fs, set_color_scheme_fs);
+static BIN_ATTR(animation, 0200, NULL, kbd_anim_write,
+		sizeof(struct kb_anim_header_t) + KB_ANIM_MAX_KEYFRAMES * sizeof(struct kb_anim_keyframe_t));
 
 static void clevo_keyboard_init_device_interface(struct platform_device *dev)
 {
+	// Hardware state unknown until written
+	mutex_lock(&kbd_led_state_lock);
+	kbd_led_hw_valid = 0;
+	mutex_unlock(&kbd_led_state_lock);
+
 	// Setup sysfs
 	if (device_create_file(&dev->dev, &dev_attr_state) != 0) {
 		TUXEDO_ERROR("Sysfs attribute file creation failed for state\n");
@@ -698,17 +1235,180 @@ static void clevo_keyboard_init_device_interface(struct platform_device *dev)
 		    ("Sysfs attribute file creation failed for brightness\n");
 	}
 
+	if (device_create_file(&dev->dev, &dev_attr_color_scheme) != 0) {
+		TUXEDO_ERROR("Sysfs attribute file creation failed for color scheme\n");
+	}
+
+	kbd_anim_init();
+	if (device_create_bin_file(&dev->dev, &bin_attr_animation) != 0) {
+		TUXEDO_ERROR("Sysfs attribute file creation failed for animation\n");
+	}
+
+	if (device_create_file(&dev->dev, &dev_attr_animation_stats) != 0) {
+		TUXEDO_ERROR("Sysfs attribute file creation failed for animation stats\n");
+	}
+
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+/*
+ * Multicolor LED class devices, one per region
+ *
+ * The multi_intensity of a device is the region color, its brightness
+ * the keyboard brightness shared by all regions. brightness_set can be
+ * called from atomic context (triggers), so it only records the request
+ * and the firmware calls are made from a work item.
+ */
+struct clevo_mc_led_t {
+	struct led_classdev_mc mc_cdev;
+	struct mc_subled subleds[3];
+	const char *name;
+	u32 field;
+	// Intensities at the last brightness_set, to tell color changes apart
+	u32 color;
+	bool registered;
+};
+
+static struct clevo_mc_led_t clevo_mc_leds[] = {
+	{ .name = "rgb:kbd_backlight_left", .field = KB_LED_COLOR_LEFT },
+	{ .name = "rgb:kbd_backlight_center", .field = KB_LED_COLOR_CENTER },
+	{ .name = "rgb:kbd_backlight_right", .field = KB_LED_COLOR_RIGHT },
+	{ .name = "rgb:kbd_backlight_extra", .field = KB_LED_COLOR_EXTRA },
+};
+
+static struct {
+	u32 fields;
+	u32 color[ARRAY_SIZE(clevo_mc_leds)];
+	u8 brightness;
+} clevo_mc_pending;
+
+static DEFINE_SPINLOCK(clevo_mc_lock);
+
+static void clevo_mc_work_func(struct work_struct *work)
+{
+	u32 fields, color[ARRAY_SIZE(clevo_mc_leds)];
+	u8 brightness;
+	unsigned long flags;
+
+	spin_lock_irqsave(&clevo_mc_lock, flags);
+	fields = clevo_mc_pending.fields;
+	memcpy(color, clevo_mc_pending.color, sizeof(color));
+	brightness = clevo_mc_pending.brightness;
+	clevo_mc_pending.fields = 0;
+	spin_unlock_irqrestore(&clevo_mc_lock, flags);
+
+	if (fields & KB_LED_COLORS)
+		kbd_anim_stop();
+
+	mutex_lock(&kbd_led_state_lock);
+	if (fields & KB_LED_COLOR_LEFT)
+		kbd_led_state.color.left = color[0];
+	if (fields & KB_LED_COLOR_CENTER)
+		kbd_led_state.color.center = color[1];
+	if (fields & KB_LED_COLOR_RIGHT)
+		kbd_led_state.color.right = color[2];
+	if (fields & KB_LED_COLOR_EXTRA)
+		kbd_led_state.color.extra = color[3];
+	if (fields & KB_LED_BRIGHTNESS)
+		kbd_led_state.brightness = brightness;
+	kbd_led_apply(fields);
+	mutex_unlock(&kbd_led_state_lock);
+}
+
+static DECLARE_WORK(clevo_mc_work, clevo_mc_work_func);
+
+static void clevo_mc_brightness_set(struct led_classdev *led_cdev, enum led_brightness brightness)
+{
+	struct led_classdev_mc *mc_cdev = lcdev_to_mccdev(led_cdev);
+	struct clevo_mc_led_t *led = container_of(mc_cdev, struct clevo_mc_led_t, mc_cdev);
+	int index = led - clevo_mc_leds;
+	unsigned long flags;
+	u32 color;
+
+	spin_lock_irqsave(&clevo_mc_lock, flags);
+	color = (led->subleds[0].intensity << 16)
+	      | (led->subleds[1].intensity << 8)
+	      | led->subleds[2].intensity;
+	// Only a multi_intensity write changes the color, a plain brightness
+	// write must not bring back outdated intensities (and stop animations)
+	if (color != led->color) {
+		clevo_mc_pending.color[index] = color;
+		clevo_mc_pending.fields |= led->field;
+		led->color = color;
+	}
+	clevo_mc_pending.brightness = brightness;
+	clevo_mc_pending.fields |= KB_LED_BRIGHTNESS;
+	spin_unlock_irqrestore(&clevo_mc_lock, flags);
+
+	schedule_work(&clevo_mc_work);
 }
 
+static enum led_brightness clevo_mc_brightness_get(struct led_classdev *led_cdev)
+{
+	return kbd_led_state.brightness;
+}
+
+static void clevo_mc_leds_init(struct platform_device *dev)
+{
+	const u32 color_ids[] = { LED_COLOR_ID_RED, LED_COLOR_ID_GREEN, LED_COLOR_ID_BLUE };
+	u32 colors[] = {
+		kbd_led_state.color.left, kbd_led_state.color.center,
+		kbd_led_state.color.right, kbd_led_state.color.extra
+	};
+	struct clevo_mc_led_t *led;
+	int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(clevo_mc_leds); ++i) {
+		led = &clevo_mc_leds[i];
+		if (led->field == KB_LED_COLOR_EXTRA && kbd_led_state.has_extra != 1)
+			continue;
+
+		for (j = 0; j < ARRAY_SIZE(led->subleds); ++j) {
+			led->subleds[j].color_index = color_ids[j];
+			led->subleds[j].intensity = (colors[i] >> (16 - 8 * j)) & 0xff;
+		}
+		led->color = colors[i] & 0xffffff;
+		led->mc_cdev.subled_info = led->subleds;
+		led->mc_cdev.num_colors = ARRAY_SIZE(led->subleds);
+		led->mc_cdev.led_cdev.name = led->name;
+		led->mc_cdev.led_cdev.max_brightness = BRIGHTNESS_MAX;
+		led->mc_cdev.led_cdev.brightness = kbd_led_state.brightness;
+		// Unregistering must not switch the backlight off
+		led->mc_cdev.led_cdev.flags |= LED_RETAIN_AT_SHUTDOWN;
+		led->mc_cdev.led_cdev.brightness_set = clevo_mc_brightness_set;
+		led->mc_cdev.led_cdev.brightness_get = clevo_mc_brightness_get;
+
+		if (led_classdev_multicolor_register(&dev->dev, &led->mc_cdev) != 0) {
+			TUXEDO_ERROR("Failed to register LED device %s\n", led->name);
+			continue;
+		}
+		led->registered = true;
+	}
+}
+
+static void clevo_mc_leds_remove(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(clevo_mc_leds); ++i) {
+		if (clevo_mc_leds[i].registered)
+			led_classdev_multicolor_unregister(&clevo_mc_leds[i].mc_cdev);
+		clevo_mc_leds[i].registered = false;
+	}
+	cancel_work_sync(&clevo_mc_work);
+}
+#else
+static void clevo_mc_leds_init(struct platform_device *dev) { }
+static void clevo_mc_leds_remove(void) { }
+#endif
+
 void clevo_keyboard_write_state(void)
 {
-	// Note:
-	// - set_blinking_pattern also writes colors
-	// - set_brightness, set_enabled, set_blinking_pattern
-	//   still also update state
-	set_blinking_pattern(kbd_led_state.blinking_pattern);
-	set_brightness(kbd_led_state.brightness);
-	set_enabled(kbd_led_state.enabled);
+	mutex_lock(&kbd_led_state_lock);
+	// Includes changes still waiting for write-behind
+	kbd_led_commit(kbd_led_pattern_fields() | KB_LED_BRIGHTNESS | KB_LED_ENABLED | kbd_led_pending);
+	kbd_led_pending = 0;
+	mutex_unlock(&kbd_led_state_lock);
 }
 
 /**
@@ -729,6 +1429,7 @@ int clevo_keyboard_init(void)
 	bool performance_profile_set_workaround;
 
 	// Init state from params
+	mutex_lock(&kbd_led_state_lock);
 	kbd_led_state.color.left = param_color_left;
 	kbd_led_state.color.center = param_color_center;
 	kbd_led_state.color.right = param_color_right;
@@ -740,6 +1441,7 @@ int clevo_keyboard_init(void)
 	kbd_led_state.brightness = param_brightness;
 
 	kbd_led_state.enabled = param_state;
+	mutex_unlock(&kbd_led_state_lock);
 
 	clevo_keyboard_write_state();
 
@@ -770,6 +1472,7 @@ static int clevo_keyboard_probe(struct platform_device *dev)
 {
 	clevo_keyboard_init_device_interface(dev);
 	clevo_keyboard_init();
+	clevo_mc_leds_init(dev);
 
 	return 0;
 }
@@ -783,6 +1486,9 @@ static void clevo_keyboard_remove_device_interface(struct platform_device *dev)
 	device_remove_file(&dev->dev, &dev_attr_extra);
 	device_remove_file(&dev->dev, &dev_attr_mode);
 	device_remove_file(&dev->dev, &dev_attr_brightness);
+	device_remove_file(&dev->dev, &dev_attr_color_scheme);
+	device_remove_bin_file(&dev->dev, &bin_attr_animation);
+	device_remove_file(&dev->dev, &dev_attr_animation_stats);
 
 	if (kbd_led_state.has_extra == 1) {
 		device_remove_file(&dev->dev, &dev_attr_color_extra);
@@ -791,14 +1497,24 @@ static void clevo_keyboard_remove_device_interface(struct platform_device *dev)
 
 static int clevo_keyboard_remove(struct platform_device *dev)
 {
+	clevo_mc_leds_remove();
 	clevo_keyboard_remove_device_interface(dev);
+	kbd_anim_stop();
+	cancel_delayed_work_sync(&kbd_led_flush_work);
 	return 0;
 }
 
 static int clevo_keyboard_suspend(struct platform_device *dev, pm_message_t state)
 {
 	// turning the keyboard off prevents default colours showing on resume
-	set_enabled_cmd(0);
+	// (the desired state stays on, so resume switches it on again)
+	// Pending write-behind changes are kept and written on resume
+	kbd_anim_stop();
+	cancel_delayed_work_sync(&kbd_led_flush_work);
+	mutex_lock(&kbd_led_state_lock);
+	if (!kbd_led_write(KB_LED_ENABLED, set_enabled_arg(0)))
+		kbd_led_hw_state.enabled = 0;
+	mutex_unlock(&kbd_led_state_lock);
 	return 0;
 }
 
@@ -806,6 +1522,12 @@ static int clevo_keyboard_resume(struct platform_device *dev)
 {
 	clevo_evaluate_method(CLEVO_METHOD_ID_GET_AP, 0, NULL);
 
+	// The firmware can come back with its default pattern, colors and
+	// brightness, so these have to be written again
+	mutex_lock(&kbd_led_state_lock);
+	kbd_led_hw_valid &= ~(KB_LED_PATTERN | KB_LED_COLORS | KB_LED_BRIGHTNESS);
+	mutex_unlock(&kbd_led_state_lock);
+
 	clevo_keyboard_write_state();
 
 	return 0;
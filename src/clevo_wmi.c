@@ -21,7 +21,9 @@
 #include <linux/module.h>
 #include <linux/wmi.h>
 #include <linux/version.h>
+#include <linux/ktime.h>
 #include "clevo_interfaces.h"
+#include "tuxedo_trace.h"
 
 static int clevo_wmi_evaluate(u32 wmi_method_id, u32 wmi_arg, u32 *result)
 {
@@ -31,13 +33,17 @@ static int clevo_wmi_evaluate(u32 wmi_method_id, u32 wmi_arg, u32 *result)
 	union acpi_object *acpi_result;
 	acpi_status status_acpi;
 	u32 return_status = 0;
+	ktime_t start, hw_time;
 
+	start = ktime_get();
 	status_acpi =
 		wmi_evaluate_method(CLEVO_WMI_METHOD_GUID, 0x00, wmi_method_id,
 				    &acpi_buffer_in, &acpi_buffer_out);
+	hw_time = ktime_sub(ktime_get(), start);
 
 	if (unlikely(ACPI_FAILURE(status_acpi))) {
 		pr_err("failed to evaluate wmi method\n");
+		trace_clevo_wmi_evaluate(wmi_method_id, wmi_arg, 0, -EIO, ktime_to_ns(hw_time));
 		return -EIO;
 	}
 
@@ -59,6 +65,11 @@ static int clevo_wmi_evaluate(u32 wmi_method_id, u32 wmi_arg, u32 *result)
 		}
 	}
 
+	trace_clevo_wmi_evaluate(wmi_method_id, wmi_arg,
+				 acpi_result && acpi_result->type == ACPI_TYPE_INTEGER ?
+				 (u32)acpi_result->integer.value : 0,
+				 (int)return_status, ktime_to_ns(hw_time));
+
 	kfree(acpi_result);
 
 	return return_status;
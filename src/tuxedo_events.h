@@ -0,0 +1,39 @@
+/*!
+ * Copyright (c) 2021 TUXEDO Computers GmbH <tux@tuxedocomputers.com>
+ *
+ * This file is part of tuxedo-keyboard.
+ *
+ * tuxedo-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef TUXEDO_EVENTS_H
+#define TUXEDO_EVENTS_H
+
+#include <linux/types.h>
+#include <linux/notifier.h>
+
+/*
+ * Hardware events as received by the vendor event callbacks, published
+ * by tuxedo_keyboard on an atomic notifier chain
+ *
+ * The chain action is the source (TUXEDO_EVENT_SOURCE_*), data points to
+ * the u32 event code. Notifiers may be called in atomic context.
+ */
+#define TUXEDO_EVENT_SOURCE_CLEVO	1
+#define TUXEDO_EVENT_SOURCE_UNIWILL	2
+
+int tuxedo_event_register_notifier(struct notifier_block *nb);
+int tuxedo_event_unregister_notifier(struct notifier_block *nb);
+void tuxedo_event_notify(u32 source, u32 code);
+
+#endif
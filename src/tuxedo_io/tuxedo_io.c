@@ -26,6 +26,26 @@
 #include <linux/cdev.h>
 #include <linux/uaccess.h>
 #include <linux/delay.h>
+#include <linux/mm.h>
+#include <linux/workqueue.h>
+#include <linux/version.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/kfifo.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/hrtimer.h>
+#include <linux/hwmon.h>
+#include <linux/thermal.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+#include <linux/io_uring/cmd.h>
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+#include <linux/io_uring.h>
+#endif
+#include "../tuxedo_events.h"
 #include "../clevo_interfaces.h"
 #include "../uniwill_interfaces.h"
 #include "tuxedo_io_ioctl.h"
@@ -55,24 +75,323 @@ static u32 uniwill_identify(void)
 	return uniwill_get_active_interface_id(NULL) == 0 ? 1 : 0;
 }
 
-/*static int fop_open(struct inode *inode, struct file *file)
+/*
+ * Per open file event queue, filled from the tuxedo_keyboard event chain
+ */
+#define EVENT_QUEUE_LENGTH	64
+
+struct tuxedo_io_file {
+	struct list_head list;
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	DECLARE_KFIFO(events, struct tuxedo_io_event_t, EVENT_QUEUE_LENGTH);
+	u32 dropped;
+};
+
+static LIST_HEAD(tuxedo_io_files);
+static DEFINE_SPINLOCK(tuxedo_io_files_lock);
+
+static uint events_dropped;
+module_param(events_dropped, uint, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(events_dropped, "Events dropped on full queues, all files (read-only)");
+
+static int tuxedo_io_event_notify(struct notifier_block *nb, unsigned long source, void *data)
+{
+	struct tuxedo_io_file *io_file;
+	struct tuxedo_io_event_t event = {
+		.timestamp_ns = ktime_get_ns(),
+		.source = source,
+		.code = *(u32 *) data,
+	};
+	unsigned long flags;
+
+	spin_lock_irqsave(&tuxedo_io_files_lock, flags);
+	list_for_each_entry(io_file, &tuxedo_io_files, list) {
+		spin_lock(&io_file->lock);
+		event.dropped = io_file->dropped;
+		if (kfifo_put(&io_file->events, event)) {
+			io_file->dropped = 0;
+		} else {
+			io_file->dropped += 1;
+			events_dropped += 1;
+		}
+		spin_unlock(&io_file->lock);
+		wake_up_interruptible(&io_file->wait);
+	}
+	spin_unlock_irqrestore(&tuxedo_io_files_lock, flags);
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block tuxedo_io_event_nb = {
+	.notifier_call = tuxedo_io_event_notify,
+};
+
+static int fop_open(struct inode *inode, struct file *file)
 {
+	struct tuxedo_io_file *io_file;
+	unsigned long flags;
+
+	io_file = kzalloc(sizeof(*io_file), GFP_KERNEL);
+	if (!io_file)
+		return -ENOMEM;
+
+	spin_lock_init(&io_file->lock);
+	init_waitqueue_head(&io_file->wait);
+	INIT_KFIFO(io_file->events);
+	file->private_data = io_file;
+
+	spin_lock_irqsave(&tuxedo_io_files_lock, flags);
+	list_add_tail(&io_file->list, &tuxedo_io_files);
+	spin_unlock_irqrestore(&tuxedo_io_files_lock, flags);
+
 	return 0;
 }
 
 static int fop_release(struct inode *inode, struct file *file)
 {
+	struct tuxedo_io_file *io_file = file->private_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&tuxedo_io_files_lock, flags);
+	list_del(&io_file->list);
+	spin_unlock_irqrestore(&tuxedo_io_files_lock, flags);
+
+	kfree(io_file);
+
 	return 0;
-}*/
+}
 
-static long clevo_ioctl_interface(struct file *file, unsigned int cmd, unsigned long arg)
+static bool event_queue_empty(struct tuxedo_io_file *io_file)
 {
-	u32 result = 0, status;
-	u32 copy_result;
-	u32 argument = (u32) arg;
+	unsigned long flags;
+	bool empty;
+
+	spin_lock_irqsave(&io_file->lock, flags);
+	empty = kfifo_is_empty(&io_file->events);
+	spin_unlock_irqrestore(&io_file->lock, flags);
+
+	return empty;
+}
+
+static ssize_t fop_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct tuxedo_io_file *io_file = file->private_data;
+	struct tuxedo_io_event_t event;
+	unsigned long flags;
+	size_t copied = 0;
+	int err;
+
+	if (count < sizeof(event))
+		return -EINVAL;
+
+	while (event_queue_empty(io_file)) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		err = wait_event_interruptible(io_file->wait, !event_queue_empty(io_file));
+		if (err)
+			return err;
+	}
+
+	while (copied + sizeof(event) <= count) {
+		spin_lock_irqsave(&io_file->lock, flags);
+		if (!kfifo_get(&io_file->events, &event)) {
+			spin_unlock_irqrestore(&io_file->lock, flags);
+			break;
+		}
+		spin_unlock_irqrestore(&io_file->lock, flags);
+
+		if (copy_to_user(buf + copied, &event, sizeof(event)))
+			return copied > 0 ? copied : -EFAULT;
+		copied += sizeof(event);
+	}
+
+	return copied;
+}
+
+static __poll_t fop_poll(struct file *file, poll_table *wait)
+{
+	struct tuxedo_io_file *io_file = file->private_data;
+
+	poll_wait(file, &io_file->wait, wait);
+
+	return event_queue_empty(io_file) ? 0 : EPOLLIN | EPOLLRDNORM;
+}
+
+/*
+ * Clevo fan speed writes
+ *
+ * The hardware takes a while before FANINFO reflects a written speed and
+ * has no ready flag. Writes return immediately, FANINFO reads before the
+ * settle time report the written target with CL_FANINFO_PENDING set and
+ * a delayed work verifies the hardware value afterwards.
+ */
+#define CL_FANSPEED_SETTLE_MS		100
+#define CL_FANSPEED_VERIFY_TOLERANCE	2
+
+static const u8 cl_faninfo_cmds[] = {
+	CLEVO_CMD_GET_FANINFO1,
+	CLEVO_CMD_GET_FANINFO2,
+	CLEVO_CMD_GET_FANINFO3
+};
+
+static struct cl_fanspeed_t {
+	bool pending;
+	u32 target;
+	unsigned long settle_deadline;
+} cl_fanspeed;
+
+static DEFINE_MUTEX(cl_fanspeed_lock);
+
+static uint cl_fanspeed_verify_failures;
+module_param(cl_fanspeed_verify_failures, uint, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(cl_fanspeed_verify_failures, "Clevo fan speed writes not reflected after settling (read-only)");
+
+static void cl_fanspeed_verify_handler(struct work_struct *work)
+{
+	u32 faninfo, target;
+	int i;
+
+	mutex_lock(&cl_fanspeed_lock);
+	if (!cl_fanspeed.pending) {
+		mutex_unlock(&cl_fanspeed_lock);
+		return;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(cl_faninfo_cmds); ++i) {
+		target = (cl_fanspeed.target >> (i * 8)) & 0xff;
+		if (clevo_evaluate_method(cl_faninfo_cmds[i], 0, &faninfo) != 0)
+			continue;
+		if (abs((int) (faninfo & 0xff) - (int) target) > CL_FANSPEED_VERIFY_TOLERANCE) {
+			pr_debug("fan %d duty %u, expected %u\n", i + 1, faninfo & 0xff, target);
+			cl_fanspeed_verify_failures += 1;
+		}
+	}
+	cl_fanspeed.pending = false;
+	mutex_unlock(&cl_fanspeed_lock);
+}
+
+static DECLARE_DELAYED_WORK(cl_fanspeed_verify_work, cl_fanspeed_verify_handler);
+
+static u32 cl_fanspeed_set(u32 argument)
+{
+	u32 result, status;
+
+	mutex_lock(&cl_fanspeed_lock);
+	status = clevo_evaluate_method(CLEVO_CMD_SET_FANSPEED_VALUE, argument, &result);
+	if (status == 0) {
+		cl_fanspeed.target = argument;
+		cl_fanspeed.settle_deadline = jiffies + msecs_to_jiffies(CL_FANSPEED_SETTLE_MS);
+		cl_fanspeed.pending = true;
+		mod_delayed_work(system_wq, &cl_fanspeed_verify_work, msecs_to_jiffies(CL_FANSPEED_SETTLE_MS));
+	}
+	mutex_unlock(&cl_fanspeed_lock);
+
+	return status;
+}
+
+static void cl_fanspeed_forget(void)
+{
+	mutex_lock(&cl_fanspeed_lock);
+	cl_fanspeed.pending = false;
+	mutex_unlock(&cl_fanspeed_lock);
+}
+
+/**
+ * FANINFO of fan index 0-2, with the pending target while a write settles
+ */
+static u32 cl_faninfo_read(int fan, u32 *result)
+{
+	u32 status;
+
+	status = clevo_evaluate_method(cl_faninfo_cmds[fan], 0, result);
 
+	mutex_lock(&cl_fanspeed_lock);
+	if (status == 0 && cl_fanspeed.pending && time_before(jiffies, cl_fanspeed.settle_deadline)) {
+		*result &= ~(0xff | CL_FANINFO_PENDING);
+		*result |= ((cl_fanspeed.target >> (fan * 8)) & 0xff) | CL_FANINFO_PENDING;
+	}
+	mutex_unlock(&cl_fanspeed_lock);
+
+	return status;
+}
+
+static void fan_control_stop(void);
+
+/**
+ * Clevo commands with one 32-bit argument or result
+ *
+ * Shared by ioctl and uring_cmd. Returns -ENOIOCTLCMD for other commands.
+ */
+static long clevo_cmd_value(unsigned int cmd, u32 argument, u32 *result)
+{
+	u32 status = 0;
 	u32 clevo_arg;
 
+	switch (cmd) {
+		case R_CL_FANINFO1:
+			status = cl_faninfo_read(0, result);
+			break;
+		case R_CL_FANINFO2:
+			status = cl_faninfo_read(1, result);
+			break;
+		case R_CL_FANINFO3:
+			status = cl_faninfo_read(2, result);
+			break;
+		case R_CL_WEBCAM_SW:
+			status = clevo_evaluate_method(CLEVO_CMD_GET_WEBCAM_SW, 0, result);
+			break;
+		case R_CL_FLIGHTMODE_SW:
+			status = clevo_evaluate_method(CLEVO_CMD_GET_FLIGHTMODE_SW, 0, result);
+			break;
+		case R_CL_TOUCHPAD_SW:
+			status = clevo_evaluate_method(CLEVO_CMD_GET_TOUCHPAD_SW, 0, result);
+			break;
+		case W_CL_FANSPEED:
+			// Note: The hardware needs time to catch up with the written value
+			// (50ms is too low), see cl_fanspeed_set()
+			status = cl_fanspeed_set(argument);
+			break;
+		case W_CL_FANAUTO:
+			fan_control_stop();
+			cl_fanspeed_forget();
+			status = clevo_evaluate_method(CLEVO_CMD_SET_FANSPEED_AUTO, argument, result);
+			break;
+		case W_CL_WEBCAM_SW:
+			status = clevo_evaluate_method(CLEVO_CMD_GET_WEBCAM_SW, 0, result);
+			// Only set status if it isn't already the right value
+			// (workaround for old and/or buggy WMI interfaces that toggle on write)
+			if ((argument & 0x01) != (*result & 0x01)) {
+				status = clevo_evaluate_method(CLEVO_CMD_SET_WEBCAM_SW, argument, result);
+			}
+			break;
+		case W_CL_FLIGHTMODE_SW:
+			status = clevo_evaluate_method(CLEVO_CMD_SET_FLIGHTMODE_SW, argument, result);
+			break;
+		case W_CL_TOUCHPAD_SW:
+			status = clevo_evaluate_method(CLEVO_CMD_SET_TOUCHPAD_SW, argument, result);
+			break;
+		case W_CL_PERF_PROFILE:
+			clevo_arg = (CLEVO_OPT_SUBCMD_SET_PERF_PROF << 0x18) | (argument & 0xff);
+			status = clevo_evaluate_method(CLEVO_CMD_OPT, clevo_arg, result);
+			break;
+		default:
+			return -ENOIOCTLCMD;
+	}
+
+	return (int) status;
+}
+
+/**
+ * Clevo ioctls, the status of the firmware call of value commands is
+ * stored in *hw_status (the ioctl itself still succeeds)
+ */
+static long clevo_ioctl_interface(struct file *file, unsigned int cmd, unsigned long arg, long *hw_status)
+{
+	u32 result = 0;
+	u32 copy_result;
+	u32 argument = (u32) arg;
+
 	const char str_no_if[] = "";
 	char *str_clevo_if;
 	
@@ -85,182 +404,399 @@ static long clevo_ioctl_interface(struct file *file, unsigned int cmd, unsigned
 			}
 			break;
 		case R_CL_FANINFO1:
-			status = clevo_evaluate_method(CLEVO_CMD_GET_FANINFO1, 0, &result);
-			copy_result = copy_to_user((int32_t *) arg, &result, sizeof(result));
-			break;
 		case R_CL_FANINFO2:
-			status = clevo_evaluate_method(CLEVO_CMD_GET_FANINFO2, 0, &result);
-			copy_result = copy_to_user((int32_t *) arg, &result, sizeof(result));
-			break;
 		case R_CL_FANINFO3:
-			status = clevo_evaluate_method(CLEVO_CMD_GET_FANINFO3, 0, &result);
-			copy_result = copy_to_user((int32_t *) arg, &result, sizeof(result));
-			break;
-		/*case R_CL_FANINFO4:
-			status = clevo_evaluate_method(CLEVO_CMD_GET_FANINFO4, 0);
-			copy_to_user((int32_t *) arg, &result, sizeof(result));
-			break;*/
+		/*case R_CL_FANINFO4:*/
 		case R_CL_WEBCAM_SW:
-			status = clevo_evaluate_method(CLEVO_CMD_GET_WEBCAM_SW, 0, &result);
-			copy_result = copy_to_user((int32_t *) arg, &result, sizeof(result));
-			break;
 		case R_CL_FLIGHTMODE_SW:
-			status = clevo_evaluate_method(CLEVO_CMD_GET_FLIGHTMODE_SW, 0, &result);
-			copy_result = copy_to_user((int32_t *) arg, &result, sizeof(result));
-			break;
 		case R_CL_TOUCHPAD_SW:
-			status = clevo_evaluate_method(CLEVO_CMD_GET_TOUCHPAD_SW, 0, &result);
+			*hw_status = clevo_cmd_value(cmd, 0, &result);
 			copy_result = copy_to_user((int32_t *) arg, &result, sizeof(result));
 			break;
 	}
 
 	switch (cmd) {
 		case W_CL_FANSPEED:
-			copy_result = copy_from_user(&argument, (int32_t *) arg, sizeof(argument));
-			clevo_evaluate_method(CLEVO_CMD_SET_FANSPEED_VALUE, argument, &result);
-			// Note: Delay needed to let hardware catch up with the written value.
-			// No known ready flag. If the value is read too soon, the old value
-			// will still be read out.
-			// (Theoretically needed for other methods as well.)
-			// Can it be lower? 50ms is too low
-			msleep(100);
-			break;
 		case W_CL_FANAUTO:
-			copy_result = copy_from_user(&argument, (int32_t *) arg, sizeof(argument));
-			clevo_evaluate_method(CLEVO_CMD_SET_FANSPEED_AUTO, argument, &result);
-			break;
 		case W_CL_WEBCAM_SW:
-			copy_result = copy_from_user(&argument, (int32_t *) arg, sizeof(argument));
-			status = clevo_evaluate_method(CLEVO_CMD_GET_WEBCAM_SW, 0, &result);
-			// Only set status if it isn't already the right value
-			// (workaround for old and/or buggy WMI interfaces that toggle on write)
-			if ((argument & 0x01) != (result & 0x01)) {
-				clevo_evaluate_method(CLEVO_CMD_SET_WEBCAM_SW, argument, &result);
-			}
-			break;
 		case W_CL_FLIGHTMODE_SW:
-			copy_result = copy_from_user(&argument, (int32_t *) arg, sizeof(argument));
-			clevo_evaluate_method(CLEVO_CMD_SET_FLIGHTMODE_SW, argument, &result);
-			break;
 		case W_CL_TOUCHPAD_SW:
-			copy_result = copy_from_user(&argument, (int32_t *) arg, sizeof(argument));
-			clevo_evaluate_method(CLEVO_CMD_SET_TOUCHPAD_SW, argument, &result);
-			break;
 		case W_CL_PERF_PROFILE:
 			copy_result = copy_from_user(&argument, (int32_t *) arg, sizeof(argument));
-			clevo_arg = (CLEVO_OPT_SUBCMD_SET_PERF_PROF << 0x18) | (argument & 0xff);
-			clevo_evaluate_method(CLEVO_CMD_OPT, clevo_arg, &result);
+			*hw_status = clevo_cmd_value(cmd, argument, &result);
 			break;
 	}
 
 	return 0;
 }
 
+/*
+ * Uniwill fan ramp-up suppression
+ *
+ * Switching to "full fan mode" makes the EC ramp the fans up. The target
+ * duties are re-asserted every UW_FAN_RAMP_PERIOD_MS for UW_FAN_RAMP_STEPS
+ * periods in the background (hrtimer -> work, the EC access can sleep).
+ * Fan writes during that window only update the targets and are picked
+ * up by the next step.
+ */
+#define UW_FAN_RAMP_STEPS	10
+#define UW_FAN_RAMP_PERIOD_MS	10
+
+static const u16 uw_fan_addresses[] = { UW_EC_RAM_FAN0_PWM, UW_EC_RAM_FAN1_PWM };
+
+static struct uw_fan_ramp_t {
+	u8 target[ARRAY_SIZE(uw_fan_addresses)];
+	u32 steps_left;
+	struct hrtimer timer;
+	struct work_struct work;
+} uw_fan_ramp;
+
+static DEFINE_MUTEX(uw_fan_ramp_lock);
+
+static void uw_fan_ramp_work_handler(struct work_struct *work)
+{
+	u8 target[ARRAY_SIZE(uw_fan_addresses)];
+	bool more;
+	int i;
+
+	mutex_lock(&uw_fan_ramp_lock);
+	if (uw_fan_ramp.steps_left == 0) {
+		mutex_unlock(&uw_fan_ramp_lock);
+		return;
+	}
+	memcpy(target, uw_fan_ramp.target, sizeof(target));
+	uw_fan_ramp.steps_left -= 1;
+	mutex_unlock(&uw_fan_ramp_lock);
+
+	for (i = 0; i < ARRAY_SIZE(uw_fan_addresses); ++i)
+		uniwill_write_ec_ram_prio(uw_fan_addresses[i], target[i], UW_EC_PRIO_FAN);
+
+	// Re-check under the lock, uw_fan_ramp_stop() may have run meanwhile
+	mutex_lock(&uw_fan_ramp_lock);
+	more = uw_fan_ramp.steps_left > 0;
+	if (more)
+		hrtimer_start(&uw_fan_ramp.timer, ms_to_ktime(UW_FAN_RAMP_PERIOD_MS), HRTIMER_MODE_REL);
+	mutex_unlock(&uw_fan_ramp_lock);
+
+	if (!more)
+		pr_debug("prevent ramp-up done\n");
+}
+
+static enum hrtimer_restart uw_fan_ramp_timer_handler(struct hrtimer *timer)
+{
+	queue_work(system_highpri_wq, &uw_fan_ramp.work);
+	return HRTIMER_NORESTART;
+}
+
+static void uw_fan_ramp_init(void)
+{
+	hrtimer_init(&uw_fan_ramp.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	uw_fan_ramp.timer.function = uw_fan_ramp_timer_handler;
+	INIT_WORK(&uw_fan_ramp.work, uw_fan_ramp_work_handler);
+}
+
+static void uw_fan_ramp_stop(void)
+{
+	mutex_lock(&uw_fan_ramp_lock);
+	uw_fan_ramp.steps_left = 0;
+	mutex_unlock(&uw_fan_ramp_lock);
+	hrtimer_cancel(&uw_fan_ramp.timer);
+	cancel_work_sync(&uw_fan_ramp.work);
+	// A timer started by the work item before it saw steps_left == 0
+	hrtimer_cancel(&uw_fan_ramp.timer);
+}
+
 static u32 uw_set_fan(u32 fan_index, u8 fan_speed)
 {
-	u32 i;
 	u8 mode_data;
-	u16 addr_fan0 = 0x1804;
-	u16 addr_fan1 = 0x1809;
-	u16 addr_for_fan;
-
-	if (fan_index == 0)
-		addr_for_fan = addr_fan0;
-	else if (fan_index == 1)
-		addr_for_fan = addr_fan1;
-	else
+
+	if (fan_index >= ARRAY_SIZE(uw_fan_addresses))
 		return -EINVAL;
 
+	mutex_lock(&uw_fan_ramp_lock);
+
+	// Merge into a running ramp-up suppression
+	if (uw_fan_ramp.steps_left > 0) {
+		uw_fan_ramp.target[fan_index] = fan_speed;
+		mutex_unlock(&uw_fan_ramp_lock);
+		return 0;
+	}
+
 	// Check current mode
-	uniwill_read_ec_ram(0x0751, &mode_data);
-	if (!(mode_data & 0x40)) {
+	uniwill_read_ec_ram_prio(UW_EC_RAM_MODE, &mode_data, UW_EC_PRIO_FAN);
+	if (!(mode_data & UW_EC_MODE_FULL_FAN)) {
 		// If not "full fan mode" (i.e. 0x40 bit set) switch to it (required for fancontrol)
-		uniwill_write_ec_ram(0x0751, mode_data | 0x40);
-		// Attempt to write both fans as quick as possible before complete ramp-up
+		uniwill_write_ec_ram_prio(UW_EC_RAM_MODE, mode_data | UW_EC_MODE_FULL_FAN, UW_EC_PRIO_FAN);
+		// Write both fans repeatedly in the background before complete ramp-up
 		pr_debug("prevent ramp-up start\n");
-		for (i = 0; i < 10; ++i) {
-			uniwill_write_ec_ram(addr_fan0, fan_speed & 0xff);
-			uniwill_write_ec_ram(addr_fan1, fan_speed & 0xff);
-			msleep(10);
-		}
-		pr_debug("prevent ramp-up done\n");
+		memset(uw_fan_ramp.target, fan_speed, sizeof(uw_fan_ramp.target));
+		uw_fan_ramp.steps_left = UW_FAN_RAMP_STEPS;
+		queue_work(system_highpri_wq, &uw_fan_ramp.work);
 	} else {
 		// Otherwise just set the chosen fan
-		uniwill_write_ec_ram(addr_for_fan, fan_speed & 0xff);
+		uniwill_write_ec_ram_prio(uw_fan_addresses[fan_index], fan_speed, UW_EC_PRIO_FAN);
 	}
 
+	mutex_unlock(&uw_fan_ramp_lock);
+
 	return 0;
 }
 
 static u32 uw_set_fan_auto(void)
 {
 	u8 mode_data;
+
+	fan_control_stop();
+	uw_fan_ramp_stop();
 	// Get current mode
-	uniwill_read_ec_ram(0x0751, &mode_data);
+	uniwill_read_ec_ram_prio(UW_EC_RAM_MODE, &mode_data, UW_EC_PRIO_FAN);
 	// Switch off "full fan mode" (i.e. unset 0x40 bit)
-	uniwill_write_ec_ram(0x0751, mode_data & 0xbf);
+	uniwill_write_ec_ram_prio(UW_EC_RAM_MODE, mode_data & ~UW_EC_MODE_FULL_FAN, UW_EC_PRIO_FAN);
 
 	return 0;
 }
 
-static long uniwill_ioctl_interface(struct file *file, unsigned int cmd, unsigned long arg)
+/**
+ * Read back the EC fan curve, bypassing the register cache
+ */
+static u32 uw_fan_curve_read(struct uw_fan_curve_t *fan_curve)
 {
-	u32 result = 0;
-	u32 copy_result;
-	u32 argument;
-	u8 byte_data;
-	const char str_no_if[] = "";
-	char *str_uniwill_if;
+	u32 i, status, result = 0;
+
+	memset(fan_curve, 0, sizeof(*fan_curve));
+	for (i = 0; i < UW_FAN_CURVE_LENGTH; ++i) {
+		status = uniwill_read_ec_ram_nocache(UW_EC_RAM_FAN_CURVE + i, &fan_curve->curve[i]);
+		if (status != 0)
+			result = status;
+		status = uniwill_read_ec_ram_nocache(UW_EC_RAM_FAN_CURVE_DEFAULT + i, &fan_curve->default_curve[i]);
+		if (status != 0)
+			result = status;
+	}
+	status = uniwill_read_ec_ram_nocache(UW_EC_RAM_MANUAL_MODE, &fan_curve->manual_mode);
+	if (status != 0)
+		result = status;
+
+	return result;
+}
+
+static long uw_fan_curve_write(const struct uw_fan_curve_t *fan_curve)
+{
+	struct uw_fan_curve_t read_back;
+	u16 addresses[UW_FAN_CURVE_LENGTH + 1];
+	u8 data[UW_FAN_CURVE_LENGTH + 1];
+	u32 i, status;
+
+	for (i = 1; i < UW_FAN_CURVE_LENGTH; ++i) {
+		if (fan_curve->curve[i] < fan_curve->curve[i - 1])
+			return -EINVAL;
+	}
+
+	// Always written, the EC may have dropped the curve without the
+	// cache knowing (this is what the read back below checks)
+	for (i = 0; i < UW_FAN_CURVE_LENGTH; ++i) {
+		addresses[i] = UW_EC_RAM_FAN_CURVE + i;
+		data[i] = fan_curve->curve[i];
+	}
+	addresses[i] = UW_EC_RAM_MANUAL_MODE;
+	data[i] = 0x01;
+	status = uniwill_write_ec_ram_multi_prio(addresses, data, ARRAY_SIZE(addresses), UW_EC_PRIO_FAN);
+	if (status != 0)
+		return (int) status;
+
+	status = uw_fan_curve_read(&read_back);
+	if (status != 0)
+		return (int) status;
+	if (memcmp(read_back.curve, fan_curve->curve, UW_FAN_CURVE_LENGTH) != 0 || read_back.manual_mode != 0x01) {
+		pr_debug("fan curve not kept by EC\n");
+		// Cached values do not match the EC anymore
+		uniwill_invalidate_ec_ram_cache();
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static long uw_ioctl_fan_curve(unsigned int cmd, unsigned long arg)
+{
+	struct uw_fan_curve_t fan_curve;
+	long status;
+
+	if (cmd == R_UW_FAN_CURVE) {
+		status = (int) uw_fan_curve_read(&fan_curve);
+		if (copy_to_user((void *) arg, &fan_curve, sizeof(fan_curve)))
+			return -EFAULT;
+		return status;
+	}
+
+	if (copy_from_user(&fan_curve, (void *) arg, sizeof(fan_curve)))
+		return -EFAULT;
+
+	return uw_fan_curve_write(&fan_curve);
+}
+
+/**
+ * Expand the requested ranges into a flat address list
+ *
+ * Returns number of addresses or negative error
+ */
+static int uw_ec_ranges_to_addresses(struct uw_ec_ranges_t *ranges, u16 *addresses)
+{
+	u32 i, j, n = 0;
+
+	if (ranges->count > UW_EC_RANGES_MAX)
+		return -EINVAL;
+
+	for (i = 0; i < ranges->count; ++i) {
+		if ((u32) ranges->range[i].addr + ranges->range[i].length > 0x10000)
+			return -EINVAL;
+		if (n + ranges->range[i].length > UW_EC_RANGES_MAX_BYTES)
+			return -E2BIG;
+		for (j = 0; j < ranges->range[i].length; ++j)
+			addresses[n++] = ranges->range[i].addr + j;
+	}
+
+	return n;
+}
+
+static long uw_ioctl_ec_ranges(unsigned int cmd, unsigned long arg)
+{
+	struct uw_ec_ranges_t ranges;
+	u16 addresses[UW_EC_RANGES_MAX_BYTES];
+	int count;
+
+	if (copy_from_user(&ranges, (void *) arg, sizeof(ranges)))
+		return -EFAULT;
 
+	count = uw_ec_ranges_to_addresses(&ranges, addresses);
+	if (count < 0)
+		return count;
+
+	if (cmd == R_UW_EC_RANGES) {
+		memset(ranges.data, 0x00, sizeof(ranges.data));
+		ranges.status = uniwill_read_ec_ram_multi(addresses, ranges.data, count);
+	}
 #ifdef DEBUG
-	union uw_ec_read_return reg_read_return;
-	union uw_ec_write_return reg_write_return;
-	u32 uw_arg[10];
-	u32 uw_result[10];
-	int i;
-	for (i = 0; i < 10; ++i) {
-		uw_result[i] = 0xdeadbeef;
+	else if (cmd == W_UW_EC_RANGES) {
+		ranges.status = uniwill_write_ec_ram_multi(addresses, ranges.data, count);
 	}
 #endif
+	ranges.data_length = count;
+
+	if (copy_to_user((void *) arg, &ranges, sizeof(ranges)))
+		return -EFAULT;
+
+	return 0;
+}
+
+/**
+ * Uniwill commands with one 32-bit argument or result
+ *
+ * Shared by ioctl and uring_cmd. Returns -ENOIOCTLCMD for other commands.
+ */
+static long uniwill_cmd_value(unsigned int cmd, u32 argument, u32 *result)
+{
+	static const u16 read_addresses[] = {
+		[0] = UW_EC_RAM_FAN0_PWM,
+		[1] = UW_EC_RAM_FAN1_PWM,
+		[2] = UW_EC_RAM_FAN0_TEMP,
+		[3] = UW_EC_RAM_FAN1_TEMP,
+		[4] = UW_EC_RAM_MODE,
+		[5] = UW_EC_RAM_MANUAL_MODE,
+	};
+	u32 status = 0;
+	u8 byte_data = 0;
+	int index = -1;
 
 	switch (cmd) {
-		case R_UW_HW_IF_STR:
-			if (uniwill_get_active_interface_id(&str_uniwill_if) == 0) {
-				copy_result = copy_to_user((char *) arg, str_uniwill_if, strlen(str_uniwill_if) + 1);
-			} else {
-				copy_result = copy_to_user((char *) arg, str_no_if, strlen(str_no_if) + 1);
-			}
-			break;
 		case R_UW_FANSPEED:
-			uniwill_read_ec_ram(0x1804, &byte_data);
-			result = byte_data;
-			copy_result = copy_to_user((void *) arg, &result, sizeof(result));
+			index = 0;
 			break;
 		case R_UW_FANSPEED2:
-			uniwill_read_ec_ram(0x1809, &byte_data);
-			result = byte_data;
-			copy_result = copy_to_user((void *) arg, &result, sizeof(result));
+			index = 1;
 			break;
 		case R_UW_FAN_TEMP:
-			uniwill_read_ec_ram(0x043e, &byte_data);
-			result = byte_data;
-			copy_result = copy_to_user((void *) arg, &result, sizeof(result));
+			index = 2;
 			break;
 		case R_UW_FAN_TEMP2:
-			uniwill_read_ec_ram(0x044f, &byte_data);
-			result = byte_data;
-			copy_result = copy_to_user((void *) arg, &result, sizeof(result));
+			index = 3;
 			break;
 		case R_UW_MODE:
-			uniwill_read_ec_ram(0x0751, &byte_data);
-			result = byte_data;
-			copy_result = copy_to_user((void *) arg, &result, sizeof(result));
+			index = 4;
 			break;
 		case R_UW_MODE_ENABLE:
-			uniwill_read_ec_ram(0x0741, &byte_data);
-			result = byte_data;
-			copy_result = copy_to_user((void *) arg, &result, sizeof(result));
+			index = 5;
 			break;
+		case W_UW_FANSPEED:
+			status = uw_set_fan(0, argument);
+			break;
+		case W_UW_FANSPEED2:
+			status = uw_set_fan(1, argument);
+			break;
+		case W_UW_MODE:
+			status = uniwill_write_ec_ram_prio(UW_EC_RAM_MODE, argument & 0xff, UW_EC_PRIO_FAN);
+			break;
+		case W_UW_MODE_ENABLE:
+			// Note: Is for the moment set and cleared on init/exit of module (uniwill mode)
+			break;
+		case W_UW_FANAUTO:
+			status = uw_set_fan_auto();
+			break;
+		default:
+			return -ENOIOCTLCMD;
+	}
+
+	if (index >= 0) {
+		status = uniwill_read_ec_ram(read_addresses[index], &byte_data);
+		*result = byte_data;
+	}
+
+	return (int) status;
+}
+
+/**
+ * Uniwill ioctls, the status of the EC access of value commands is
+ * stored in *hw_status (the ioctl itself still succeeds)
+ */
+static long uniwill_ioctl_interface(struct file *file, unsigned int cmd, unsigned long arg, long *hw_status)
+{
+	u32 result = 0;
+	u32 copy_result;
+	u32 argument;
+	const char str_no_if[] = "";
+	char *str_uniwill_if;
+
+#ifdef DEBUG
+	union uw_ec_read_return reg_read_return;
+	union uw_ec_write_return reg_write_return;
+	u32 uw_arg[10];
+	u32 uw_result[10];
+	int i;
+	for (i = 0; i < 10; ++i) {
+		uw_result[i] = 0xdeadbeef;
+	}
+#endif
+
+	switch (cmd) {
+		case R_UW_HW_IF_STR:
+			if (uniwill_get_active_interface_id(&str_uniwill_if) == 0) {
+				copy_result = copy_to_user((char *) arg, str_uniwill_if, strlen(str_uniwill_if) + 1);
+			} else {
+				copy_result = copy_to_user((char *) arg, str_no_if, strlen(str_no_if) + 1);
+			}
+			break;
+		case R_UW_FANSPEED:
+		case R_UW_FANSPEED2:
+		case R_UW_FAN_TEMP:
+		case R_UW_FAN_TEMP2:
+		case R_UW_MODE:
+		case R_UW_MODE_ENABLE:
+			*hw_status = uniwill_cmd_value(cmd, 0, &result);
+			copy_result = copy_to_user((void *) arg, &result, sizeof(result));
+			break;
+		case R_UW_EC_RANGES:
+			return uw_ioctl_ec_ranges(cmd, arg);
+		case R_UW_FAN_CURVE:
+			return uw_ioctl_fan_curve(cmd, arg);
 #ifdef DEBUG
 		case R_TF_BC:
 			copy_result = copy_from_user(&uw_arg, (void *) arg, sizeof(uw_arg));
@@ -281,18 +817,10 @@ static long uniwill_ioctl_interface(struct file *file, unsigned int cmd, unsigne
 
 	switch (cmd) {
 		case W_UW_FANSPEED:
-			// Get fan speed argument
-			copy_result = copy_from_user(&argument, (int32_t *) arg, sizeof(argument));
-			uw_set_fan(0, argument);
-			break;
 		case W_UW_FANSPEED2:
-			// Get fan speed argument
-			copy_result = copy_from_user(&argument, (int32_t *) arg, sizeof(argument));
-			uw_set_fan(1, argument);
-			break;
 		case W_UW_MODE:
 			copy_result = copy_from_user(&argument, (int32_t *) arg, sizeof(argument));
-			uniwill_write_ec_ram(0x0751, argument & 0xff);
+			*hw_status = uniwill_cmd_value(cmd, argument, &result);
 			break;
 		case W_UW_MODE_ENABLE:
 			// Note: Is for the moment set and cleared on init/exit of module (uniwill mode)
@@ -301,8 +829,10 @@ static long uniwill_ioctl_interface(struct file *file, unsigned int cmd, unsigne
 			uniwill_write_ec_ram(0x0741, argument & 0x01);
 			*/
 			break;
+		case W_UW_FAN_CURVE:
+			return uw_ioctl_fan_curve(cmd, arg);
 		case W_UW_FANAUTO:
-			uw_set_fan_auto();
+			*hw_status = uniwill_cmd_value(cmd, 0, &result);
 			break;
 #ifdef DEBUG
 		case W_TF_BC:
@@ -323,15 +853,413 @@ static long uniwill_ioctl_interface(struct file *file, unsigned int cmd, unsigne
 			pr_info("addr_high %0#2x\n", reg_write_return.bytes.addr_high);
 			pr_info("addr_low %0#2x\n", reg_write_return.bytes.addr_low);*/
 			break;
+		case W_UW_EC_RANGES:
+			return uw_ioctl_ec_ranges(cmd, arg);
 #endif
 	}
 
 	return 0;
 }
 
-static long fop_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+/*
+ * Fan curve controller
+ *
+ * Runs the uploaded curves against the active backend from a deferrable
+ * work, so it does not wake an idle system just for itself.
+ */
+#define FAN_CONTROL_FANS		3
+#define FAN_CONTROL_INTERVAL_MS_MIN	100
+
+static uint fan_control_interval_ms = 1000;
+module_param(fan_control_interval_ms, uint, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(fan_control_interval_ms, "Period of the fan curve controller (default: 1000, min: 100)");
+
+static struct fan_control_t {
+	bool enabled;
+	bool duty_valid;
+	u8 duty;
+	struct tuxedo_io_fan_curve_t curve;
+} fan_control[FAN_CONTROL_FANS];
+
+static DEFINE_MUTEX(fan_control_lock);
+
+static u8 fan_curve_duty(const struct tuxedo_io_fan_curve_t *curve, int temp)
 {
-	u32 status;
+	int i, t0, t1, d0, d1;
+	u32 last = curve->points - 1;
+
+	if (temp <= curve->point[0].temp)
+		return curve->point[0].duty;
+	if (temp >= curve->point[last].temp)
+		return curve->point[last].duty;
+
+	for (i = 0; i < last; ++i) {
+		t1 = curve->point[i + 1].temp;
+		if (temp < t1)
+			break;
+	}
+	t0 = curve->point[i].temp;
+	d0 = curve->point[i].duty;
+	d1 = curve->point[i + 1].duty;
+
+	return d0 + (d1 - d0) * (temp - t0) / (t1 - t0);
+}
+
+/**
+ * Next duty for the measured temperature, with hysteresis and slew limits
+ */
+static u8 fan_control_step(struct fan_control_t *fc, u8 temp)
+{
+	const struct tuxedo_io_fan_curve_t *curve = &fc->curve;
+	int target = fan_curve_duty(curve, temp);
+	int delta;
+
+	if (!fc->duty_valid)
+		return target;
+
+	if (target < fc->duty)
+		target = min_t(int, fan_curve_duty(curve, temp + curve->hysteresis), fc->duty);
+
+	delta = target - fc->duty;
+	if (curve->slew_up > 0 && delta > curve->slew_up)
+		delta = curve->slew_up;
+	if (curve->slew_down > 0 && delta < -curve->slew_down)
+		delta = -curve->slew_down;
+
+	return fc->duty + delta;
+}
+
+static void fan_control_clevo(void)
+{
+	u32 faninfo[FAN_CONTROL_FANS], argument = 0, previous = 0;
+	u8 duty;
+	int i;
+
+	// All duties are written at once, skip the tick rather than guess one
+	for (i = 0; i < FAN_CONTROL_FANS; ++i) {
+		if (cl_faninfo_read(i, &faninfo[i]) != 0)
+			return;
+	}
+
+	for (i = 0; i < FAN_CONTROL_FANS; ++i) {
+		duty = faninfo[i] & 0xff;
+		previous |= (u32) duty << (i * 8);
+		if (fan_control[i].enabled) {
+			duty = fan_control_step(&fan_control[i], (faninfo[i] >> 16) & 0xff);
+			fan_control[i].duty = duty;
+			fan_control[i].duty_valid = true;
+		}
+		argument |= (u32) duty << (i * 8);
+	}
+
+	if (argument != previous)
+		cl_fanspeed_set(argument);
+}
+
+static void fan_control_uniwill(void)
+{
+	static const u16 temp_addresses[] = { UW_EC_RAM_FAN0_TEMP, UW_EC_RAM_FAN1_TEMP };
+	u8 temp, duty;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(temp_addresses); ++i) {
+		if (!fan_control[i].enabled)
+			continue;
+		if (uniwill_read_ec_ram_prio(temp_addresses[i], &temp, UW_EC_PRIO_FAN) != 0)
+			continue;
+		duty = fan_control_step(&fan_control[i], temp);
+		if (!fan_control[i].duty_valid || duty != fan_control[i].duty)
+			uw_set_fan(i, duty);
+		fan_control[i].duty = duty;
+		fan_control[i].duty_valid = true;
+	}
+}
+
+static void fan_control_work_handler(struct work_struct *work);
+static DECLARE_DEFERRABLE_WORK(fan_control_work, fan_control_work_handler);
+
+static void fan_control_work_handler(struct work_struct *work)
+{
+	bool active = false;
+	int i;
+
+	mutex_lock(&fan_control_lock);
+	for (i = 0; i < FAN_CONTROL_FANS; ++i)
+		active |= fan_control[i].enabled;
+
+	if (active) {
+		if (clevo_identify())
+			fan_control_clevo();
+		else if (uniwill_identify())
+			fan_control_uniwill();
+		schedule_delayed_work(&fan_control_work,
+			msecs_to_jiffies(max_t(uint, fan_control_interval_ms, FAN_CONTROL_INTERVAL_MS_MIN)));
+	}
+	mutex_unlock(&fan_control_lock);
+}
+
+static void fan_control_stop(void)
+{
+	int i;
+
+	mutex_lock(&fan_control_lock);
+	for (i = 0; i < FAN_CONTROL_FANS; ++i)
+		fan_control[i].enabled = false;
+	mutex_unlock(&fan_control_lock);
+}
+
+/**
+ * Hand one fan back from its curve to manual writes, returns once a
+ * running controller tick is done
+ */
+static void fan_control_release(int fan)
+{
+	mutex_lock(&fan_control_lock);
+	fan_control[fan].enabled = false;
+	mutex_unlock(&fan_control_lock);
+}
+
+static long fan_control_ioctl(unsigned long arg)
+{
+	struct tuxedo_io_fan_curve_t curve;
+	u32 fans, i;
+
+	if (copy_from_user(&curve, (void *) arg, sizeof(curve)))
+		return -EFAULT;
+
+	if (clevo_identify())
+		fans = ARRAY_SIZE(cl_faninfo_cmds);
+	else if (uniwill_identify())
+		fans = ARRAY_SIZE(uw_fan_addresses);
+	else
+		return -ENODEV;
+
+	if (curve.fan >= fans)
+		return -EINVAL;
+
+	if (curve.enable) {
+		if (curve.points == 0 || curve.points > TUXEDO_IO_FAN_CURVE_POINTS)
+			return -EINVAL;
+		for (i = 1; i < curve.points; ++i) {
+			if (curve.point[i].temp <= curve.point[i - 1].temp)
+				return -EINVAL;
+		}
+	}
+
+	mutex_lock(&fan_control_lock);
+	fan_control[curve.fan].enabled = curve.enable != 0;
+	fan_control[curve.fan].duty_valid = false;
+	fan_control[curve.fan].curve = curve;
+	mutex_unlock(&fan_control_lock);
+
+	if (curve.enable)
+		mod_delayed_work(system_wq, &fan_control_work, 0);
+
+	return 0;
+}
+
+static long telemetry_ioctl_snapshot(unsigned long arg);
+
+/*
+ * Per-command ioctl statistics
+ *
+ * Every ioctl is timed and accounted in log2 nanosecond buckets. The
+ * table is in <debugfs>/tuxedo_io/latency, writing to
+ * <debugfs>/tuxedo_io/reset clears it.
+ */
+#define IOCTL_STATS_BUCKETS	32
+
+struct ioctl_stats {
+	unsigned int cmd;
+	const char *name;
+	atomic64_t calls;
+	atomic64_t errors;
+	atomic64_t total_ns;
+	atomic64_t max_ns;
+	atomic64_t buckets[IOCTL_STATS_BUCKETS]; // [i]: < 2^i ns, [0]: 0 ns
+};
+
+#define IOCTL_STATS_ENTRY(c)	{ .cmd = c, .name = #c }
+
+static struct ioctl_stats ioctl_stats[] = {
+	IOCTL_STATS_ENTRY(R_MOD_VERSION),
+	IOCTL_STATS_ENTRY(R_HWCHECK_CL),
+	IOCTL_STATS_ENTRY(R_HWCHECK_UW),
+	IOCTL_STATS_ENTRY(R_TELEMETRY_SNAPSHOT),
+	IOCTL_STATS_ENTRY(W_FAN_CURVE),
+	IOCTL_STATS_ENTRY(R_CL_HW_IF_STR),
+	IOCTL_STATS_ENTRY(R_CL_FANINFO1),
+	IOCTL_STATS_ENTRY(R_CL_FANINFO2),
+	IOCTL_STATS_ENTRY(R_CL_FANINFO3),
+	IOCTL_STATS_ENTRY(R_CL_WEBCAM_SW),
+	IOCTL_STATS_ENTRY(R_CL_FLIGHTMODE_SW),
+	IOCTL_STATS_ENTRY(R_CL_TOUCHPAD_SW),
+	IOCTL_STATS_ENTRY(W_CL_FANSPEED),
+	IOCTL_STATS_ENTRY(W_CL_FANAUTO),
+	IOCTL_STATS_ENTRY(W_CL_WEBCAM_SW),
+	IOCTL_STATS_ENTRY(W_CL_FLIGHTMODE_SW),
+	IOCTL_STATS_ENTRY(W_CL_TOUCHPAD_SW),
+	IOCTL_STATS_ENTRY(W_CL_PERF_PROFILE),
+	IOCTL_STATS_ENTRY(R_UW_HW_IF_STR),
+	IOCTL_STATS_ENTRY(R_UW_FANSPEED),
+	IOCTL_STATS_ENTRY(R_UW_FANSPEED2),
+	IOCTL_STATS_ENTRY(R_UW_FAN_TEMP),
+	IOCTL_STATS_ENTRY(R_UW_FAN_TEMP2),
+	IOCTL_STATS_ENTRY(R_UW_MODE),
+	IOCTL_STATS_ENTRY(R_UW_MODE_ENABLE),
+	IOCTL_STATS_ENTRY(R_UW_EC_RANGES),
+	IOCTL_STATS_ENTRY(R_UW_FAN_CURVE),
+	IOCTL_STATS_ENTRY(W_UW_FANSPEED),
+	IOCTL_STATS_ENTRY(W_UW_FANSPEED2),
+	IOCTL_STATS_ENTRY(W_UW_MODE),
+	IOCTL_STATS_ENTRY(W_UW_MODE_ENABLE),
+	IOCTL_STATS_ENTRY(W_UW_FANAUTO),
+	IOCTL_STATS_ENTRY(W_UW_FAN_CURVE),
+#ifdef DEBUG
+	IOCTL_STATS_ENTRY(R_TF_BC),
+	IOCTL_STATS_ENTRY(W_TF_BC),
+	IOCTL_STATS_ENTRY(W_UW_EC_RANGES),
+#endif
+	// Must stay last, collects unknown commands
+	{ .cmd = 0, .name = "other" },
+};
+
+static struct dentry *tuxedo_io_debugfs;
+
+static struct ioctl_stats *ioctl_stats_find(unsigned int cmd)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ioctl_stats) - 1; ++i) {
+		if (ioctl_stats[i].cmd == cmd)
+			return &ioctl_stats[i];
+	}
+
+	return &ioctl_stats[ARRAY_SIZE(ioctl_stats) - 1];
+}
+
+static void ioctl_stats_account(unsigned int cmd, u64 ns, long status)
+{
+	struct ioctl_stats *stats = ioctl_stats_find(cmd);
+	int bucket = min(fls64(ns), IOCTL_STATS_BUCKETS - 1);
+	s64 max, prev;
+
+	atomic64_inc(&stats->calls);
+	if (status < 0)
+		atomic64_inc(&stats->errors);
+	atomic64_add(ns, &stats->total_ns);
+	atomic64_inc(&stats->buckets[bucket]);
+
+	max = atomic64_read(&stats->max_ns);
+	while ((s64) ns > max) {
+		prev = atomic64_cmpxchg(&stats->max_ns, max, ns);
+		if (prev == max)
+			break;
+		max = prev;
+	}
+}
+
+/**
+ * Upper bound in ns of the bucket holding the given percentile
+ */
+static u64 ioctl_stats_percentile(const u64 *buckets, u64 count, unsigned int percent, u64 max)
+{
+	u64 target = div_u64(count * percent + 99, 100);
+	u64 sum = 0;
+	int i;
+
+	for (i = 0; i < IOCTL_STATS_BUCKETS - 1; ++i) {
+		sum += buckets[i];
+		if (sum >= target)
+			return min(i == 0 ? 0ULL : (1ULL << i) - 1, max);
+	}
+
+	return max;
+}
+
+static int ioctl_stats_latency_show(struct seq_file *s, void *unused)
+{
+	u64 buckets[IOCTL_STATS_BUCKETS];
+	u64 calls, count, max;
+	int i, j;
+
+	seq_printf(s, "%-22s %10s %8s %10s %10s %10s %10s\n",
+		   "command", "calls", "errors", "avg_ns", "p50_ns", "p99_ns", "max_ns");
+	for (i = 0; i < ARRAY_SIZE(ioctl_stats); ++i) {
+		struct ioctl_stats *stats = &ioctl_stats[i];
+
+		calls = atomic64_read(&stats->calls);
+		if (calls == 0)
+			continue;
+
+		count = 0;
+		for (j = 0; j < IOCTL_STATS_BUCKETS; ++j) {
+			buckets[j] = atomic64_read(&stats->buckets[j]);
+			count += buckets[j];
+		}
+		max = atomic64_read(&stats->max_ns);
+
+		seq_printf(s, "%-22s %10llu %8llu %10llu %10llu %10llu %10llu\n",
+			   stats->name, calls, (u64) atomic64_read(&stats->errors),
+			   div64_u64(atomic64_read(&stats->total_ns), calls),
+			   ioctl_stats_percentile(buckets, count, 50, max),
+			   ioctl_stats_percentile(buckets, count, 99, max), max);
+	}
+
+	// Raw histograms, "<upper bound ns>:<count>" for non-empty buckets
+	seq_puts(s, "\n");
+	for (i = 0; i < ARRAY_SIZE(ioctl_stats); ++i) {
+		struct ioctl_stats *stats = &ioctl_stats[i];
+
+		if (atomic64_read(&stats->calls) == 0)
+			continue;
+
+		seq_printf(s, "%s:", stats->name);
+		for (j = 0; j < IOCTL_STATS_BUCKETS; ++j) {
+			count = atomic64_read(&stats->buckets[j]);
+			if (count == 0)
+				continue;
+			if (j == IOCTL_STATS_BUCKETS - 1)
+				seq_printf(s, " inf:%llu", count);
+			else
+				seq_printf(s, " %llu:%llu", j == 0 ? 0ULL : (1ULL << j) - 1, count);
+		}
+		seq_puts(s, "\n");
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ioctl_stats_latency);
+
+static int ioctl_stats_reset_set(void *data, u64 value)
+{
+	int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(ioctl_stats); ++i) {
+		struct ioctl_stats *stats = &ioctl_stats[i];
+
+		atomic64_set(&stats->calls, 0);
+		atomic64_set(&stats->errors, 0);
+		atomic64_set(&stats->total_ns, 0);
+		atomic64_set(&stats->max_ns, 0);
+		for (j = 0; j < IOCTL_STATS_BUCKETS; ++j)
+			atomic64_set(&stats->buckets[j], 0);
+	}
+
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(ioctl_stats_reset_fops, NULL, ioctl_stats_reset_set, "%llu\n");
+
+static void ioctl_stats_init(void)
+{
+	tuxedo_io_debugfs = debugfs_create_dir("tuxedo_io", NULL);
+	debugfs_create_file("latency", S_IRUSR, tuxedo_io_debugfs, NULL, &ioctl_stats_latency_fops);
+	debugfs_create_file_unsafe("reset", S_IWUSR, tuxedo_io_debugfs, NULL, &ioctl_stats_reset_fops);
+}
+
+static long fop_ioctl_dispatch(struct file *file, unsigned int cmd, unsigned long arg, long *hw_status)
+{
+	long status;
 	// u32 result = 0;
 	u32 copy_result;
 
@@ -349,32 +1277,895 @@ static long fop_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			id_check_uniwill = uniwill_identify();
 			copy_result = copy_to_user((void *) arg, (void *) &id_check_uniwill, sizeof(id_check_uniwill));
 			break;
+		case R_TELEMETRY_SNAPSHOT:
+			return telemetry_ioctl_snapshot(arg);
+		case W_FAN_CURVE:
+			return fan_control_ioctl(arg);
 	}
 
-	status = clevo_ioctl_interface(file, cmd, arg);
+	status = clevo_ioctl_interface(file, cmd, arg, hw_status);
 	if (status != 0) return status;
-	status = uniwill_ioctl_interface(file, cmd, arg);
+	status = uniwill_ioctl_interface(file, cmd, arg, hw_status);
 	if (status != 0) return status;
 
 	return 0;
 }
 
+static long fop_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	u64 start = ktime_get_ns();
+	long hw_status = 0;
+	long status = fop_ioctl_dispatch(file, cmd, arg, &hw_status);
+
+	// Value commands return 0 on hardware errors, count those as well
+	ioctl_stats_account(cmd, ktime_get_ns() - start, status != 0 ? status : hw_status);
+
+	return status;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+/*
+ * io_uring passthrough
+ *
+ * Each command is run from the unbound workqueue so that independent
+ * requests wait on the EC transport in parallel and complete in the
+ * order the hardware finishes them, not in submission order.
+ */
+struct tuxedo_io_uring_req {
+	struct work_struct work;
+	struct io_uring_cmd *ioucmd;
+	unsigned int cmd;
+	u32 argument;
+	u32 result;
+	long status;
+};
+
+static struct tuxedo_io_uring_req **uring_req_pdu(struct io_uring_cmd *ioucmd)
+{
+	return (struct tuxedo_io_uring_req **) ioucmd->pdu;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+static void uring_cmd_complete(struct io_uring_cmd *ioucmd, unsigned issue_flags)
+#else
+static void uring_cmd_complete(struct io_uring_cmd *ioucmd)
+#endif
+{
+	struct tuxedo_io_uring_req *req = *uring_req_pdu(ioucmd);
+	long status = req->status;
+	u32 result = req->result;
+
+	kfree(req);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	io_uring_cmd_done(ioucmd, status, result, issue_flags);
+#else
+	io_uring_cmd_done(ioucmd, status, result);
+#endif
+}
+
+static void uring_cmd_work(struct work_struct *work)
+{
+	struct tuxedo_io_uring_req *req = container_of(work, struct tuxedo_io_uring_req, work);
+
+	req->status = clevo_cmd_value(req->cmd, req->argument, &req->result);
+	if (req->status == -ENOIOCTLCMD)
+		req->status = uniwill_cmd_value(req->cmd, req->argument, &req->result);
+	if (req->status == -ENOIOCTLCMD)
+		req->status = -EINVAL;
+
+	io_uring_cmd_complete_in_task(req->ioucmd, uring_cmd_complete);
+}
+
+static const struct tuxedo_io_uring_cmd_t *uring_cmd_payload(struct io_uring_cmd *ioucmd)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 6, 0)
+	return io_uring_sqe_cmd(ioucmd->sqe);
+#else
+	return ioucmd->cmd;
+#endif
+}
+
+static int fop_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags)
+{
+	const struct tuxedo_io_uring_cmd_t *payload = uring_cmd_payload(ioucmd);
+	struct tuxedo_io_uring_req *req;
+
+	// Results are returned in the second half of a big CQE
+	if (!(issue_flags & IO_URING_F_CQE32))
+		return -EINVAL;
+
+	switch (ioucmd->cmd_op) {
+		case R_CL_FANINFO1:
+		case R_CL_FANINFO2:
+		case R_CL_FANINFO3:
+		case R_CL_WEBCAM_SW:
+		case R_CL_FLIGHTMODE_SW:
+		case R_CL_TOUCHPAD_SW:
+		case W_CL_FANSPEED:
+		case W_CL_FANAUTO:
+		case W_CL_WEBCAM_SW:
+		case W_CL_FLIGHTMODE_SW:
+		case W_CL_TOUCHPAD_SW:
+		case W_CL_PERF_PROFILE:
+		case R_UW_FANSPEED:
+		case R_UW_FANSPEED2:
+		case R_UW_FAN_TEMP:
+		case R_UW_FAN_TEMP2:
+		case R_UW_MODE:
+		case R_UW_MODE_ENABLE:
+		case W_UW_FANSPEED:
+		case W_UW_FANSPEED2:
+		case W_UW_MODE:
+		case W_UW_MODE_ENABLE:
+		case W_UW_FANAUTO:
+			break;
+		default:
+			return -EINVAL;
+	}
+
+	req = kzalloc(sizeof(*req), (issue_flags & IO_URING_F_NONBLOCK) ? GFP_NOWAIT : GFP_KERNEL);
+	if (!req)
+		return -ENOMEM;
+
+	INIT_WORK(&req->work, uring_cmd_work);
+	req->ioucmd = ioucmd;
+	req->cmd = ioucmd->cmd_op;
+	req->argument = payload->argument;
+	*uring_req_pdu(ioucmd) = req;
+
+	queue_work(system_unbound_wq, &req->work);
+
+	return -EIOCBQUEUED;
+}
+#endif
+
+/*
+ * Telemetry shadow page
+ *
+ * One kernel page shared read-only with all mappings. The sampler only
+ * runs while at least one mapping exists, so many readers share one
+ * hardware poll.
+ */
+#define TELEMETRY_INTERVAL_MS_MIN	50
+
+static uint telemetry_interval_ms = 500;
+module_param(telemetry_interval_ms, uint, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(telemetry_interval_ms, "Refresh interval of the mmap telemetry page (default: 500, min: 50)");
+
+static struct tuxedo_io_shadow_t *tuxedo_io_shadow;
+static atomic_t tuxedo_io_shadow_maps = ATOMIC_INIT(0);
+
+static const u16 shadow_uw_addresses[] = {
+	UW_EC_RAM_FAN0_PWM,
+	UW_EC_RAM_FAN1_PWM,
+	UW_EC_RAM_FAN0_TEMP,
+	UW_EC_RAM_FAN1_TEMP,
+	UW_EC_RAM_MODE,
+	UW_EC_RAM_MANUAL_MODE
+};
+
+static void shadow_sample_work_handler(struct work_struct *work);
+static DECLARE_DELAYED_WORK(shadow_sample_work, shadow_sample_work_handler);
+
+static unsigned long shadow_interval(void)
+{
+	return msecs_to_jiffies(max_t(uint, telemetry_interval_ms, TELEMETRY_INTERVAL_MS_MIN));
+}
+
+static void shadow_sample_work_handler(struct work_struct *work)
+{
+	struct tuxedo_io_shadow_t *shadow = tuxedo_io_shadow;
+	u8 uw_data[ARRAY_SIZE(shadow_uw_addresses)];
+	u32 cl_faninfo[3] = { 0 };
+	int32_t uw_status = -ENODEV, cl_status = -ENODEV;
+	int i;
+
+	// Sample hardware before entering the write side, interfaces can
+	// show up after module init so check on every sample
+	if (uniwill_identify())
+		uw_status = uniwill_read_ec_ram_multi(shadow_uw_addresses, uw_data,
+						      ARRAY_SIZE(shadow_uw_addresses));
+	if (clevo_identify()) {
+		for (i = 0; i < ARRAY_SIZE(cl_faninfo); ++i) {
+			cl_status = cl_faninfo_read(i, &cl_faninfo[i]);
+			if (cl_status != 0)
+				break;
+		}
+	}
+
+	WRITE_ONCE(shadow->seq, shadow->seq + 1);
+	smp_wmb();
+
+	shadow->timestamp_ns = ktime_get_ns();
+	shadow->interval_ms = max_t(uint, telemetry_interval_ms, TELEMETRY_INTERVAL_MS_MIN);
+	shadow->samples += 1;
+	shadow->uw_status = uw_status;
+	if (uw_status == 0) {
+		shadow->uw_fanspeed = uw_data[0];
+		shadow->uw_fanspeed2 = uw_data[1];
+		shadow->uw_fan_temp = uw_data[2];
+		shadow->uw_fan_temp2 = uw_data[3];
+		shadow->uw_mode = uw_data[4];
+		shadow->uw_mode_enable = uw_data[5];
+	}
+	shadow->cl_status = cl_status;
+	if (cl_status == 0)
+		memcpy(shadow->cl_faninfo, cl_faninfo, sizeof(cl_faninfo));
+
+	smp_wmb();
+	WRITE_ONCE(shadow->seq, shadow->seq + 1);
+
+	if (atomic_read(&tuxedo_io_shadow_maps) > 0)
+		schedule_delayed_work(&shadow_sample_work, shadow_interval());
+}
+
+static void shadow_vm_open(struct vm_area_struct *vma)
+{
+	if (atomic_inc_return(&tuxedo_io_shadow_maps) == 1)
+		mod_delayed_work(system_wq, &shadow_sample_work, 0);
+}
+
+static void shadow_vm_close(struct vm_area_struct *vma)
+{
+	// Sampler stops by itself on the next run
+	atomic_dec(&tuxedo_io_shadow_maps);
+}
+
+static const struct vm_operations_struct shadow_vm_ops = {
+	.open = shadow_vm_open,
+	.close = shadow_vm_close,
+};
+
+/**
+ * Consistent copy of the shadow page if it is refreshed and recent
+ */
+static bool shadow_copy_fresh(struct tuxedo_io_shadow_t *copy)
+{
+	u32 seq;
+	u64 max_age_ns;
+
+	if (atomic_read(&tuxedo_io_shadow_maps) == 0)
+		return false;
+
+	do {
+		seq = READ_ONCE(tuxedo_io_shadow->seq);
+		smp_rmb();
+		memcpy(copy, tuxedo_io_shadow, sizeof(*copy));
+		smp_rmb();
+	} while ((seq & 1) || seq != READ_ONCE(tuxedo_io_shadow->seq));
+
+	// Allow one missed refresh
+	max_age_ns = 2ULL * copy->interval_ms * NSEC_PER_MSEC;
+	return copy->samples > 0 && ktime_get_ns() - copy->timestamp_ns <= max_age_ns;
+}
+
+static void telemetry_clevo_faninfo(struct tuxedo_io_telemetry_t *snapshot, int fan, u32 faninfo)
+{
+	snapshot->fan_duty[fan] = faninfo & 0xff;
+	snapshot->fan_temp[fan] = (faninfo >> 16) & 0xff;
+	snapshot->valid |= TUXEDO_IO_TELEMETRY_VALID_FAN_DUTY(fan) | TUXEDO_IO_TELEMETRY_VALID_FAN_TEMP(fan);
+}
+
+/**
+ * Clevo: FANINFO from the shadow page if fresh, otherwise one method
+ * call per fan. The switch states are always read from hardware if
+ * requested.
+ */
+static void telemetry_clevo(struct tuxedo_io_telemetry_t *snapshot, struct tuxedo_io_shadow_t *shadow, bool shadow_fresh,
+			    bool with_switches)
+{
+	u32 result;
+	int i;
+
+	snapshot->vendor = TUXEDO_IO_TELEMETRY_VENDOR_CLEVO;
+
+	if (shadow_fresh && shadow->cl_status == 0) {
+		for (i = 0; i < ARRAY_SIZE(cl_faninfo_cmds); ++i)
+			telemetry_clevo_faninfo(snapshot, i, shadow->cl_faninfo[i]);
+		snapshot->timestamp_ns = shadow->timestamp_ns;
+		snapshot->flags |= TUXEDO_IO_TELEMETRY_FROM_SHADOW;
+	} else {
+		snapshot->timestamp_ns = ktime_get_ns();
+		for (i = 0; i < ARRAY_SIZE(cl_faninfo_cmds); ++i) {
+			if (cl_faninfo_read(i, &result) == 0)
+				telemetry_clevo_faninfo(snapshot, i, result);
+		}
+	}
+
+	if (!with_switches)
+		return;
+
+	if (clevo_evaluate_method(CLEVO_CMD_GET_WEBCAM_SW, 0, &result) == 0) {
+		snapshot->webcam_sw = result & 0x01;
+		snapshot->valid |= TUXEDO_IO_TELEMETRY_VALID_WEBCAM_SW;
+	}
+	if (clevo_evaluate_method(CLEVO_CMD_GET_FLIGHTMODE_SW, 0, &result) == 0) {
+		snapshot->flightmode_sw = result & 0x01;
+		snapshot->valid |= TUXEDO_IO_TELEMETRY_VALID_FLIGHTMODE_SW;
+	}
+	if (clevo_evaluate_method(CLEVO_CMD_GET_TOUCHPAD_SW, 0, &result) == 0) {
+		snapshot->touchpad_sw = result & 0x01;
+		snapshot->valid |= TUXEDO_IO_TELEMETRY_VALID_TOUCHPAD_SW;
+	}
+}
+
+/**
+ * Uniwill: the shadow page if fresh, otherwise all registers in one
+ * hold of the EC lock
+ */
+static void telemetry_uniwill(struct tuxedo_io_telemetry_t *snapshot, struct tuxedo_io_shadow_t *shadow, bool shadow_fresh)
+{
+	u8 data[ARRAY_SIZE(shadow_uw_addresses)];
+
+	snapshot->vendor = TUXEDO_IO_TELEMETRY_VENDOR_UNIWILL;
+
+	if (shadow_fresh && shadow->uw_status == 0) {
+		data[0] = shadow->uw_fanspeed;
+		data[1] = shadow->uw_fanspeed2;
+		data[2] = shadow->uw_fan_temp;
+		data[3] = shadow->uw_fan_temp2;
+		data[4] = shadow->uw_mode;
+		data[5] = shadow->uw_mode_enable;
+		snapshot->timestamp_ns = shadow->timestamp_ns;
+		snapshot->flags |= TUXEDO_IO_TELEMETRY_FROM_SHADOW;
+	} else {
+		snapshot->timestamp_ns = ktime_get_ns();
+		if (uniwill_read_ec_ram_multi(shadow_uw_addresses, data, ARRAY_SIZE(shadow_uw_addresses)) != 0)
+			return;
+	}
+
+	snapshot->fan_duty[0] = data[0];
+	snapshot->fan_duty[1] = data[1];
+	snapshot->fan_temp[0] = data[2];
+	snapshot->fan_temp[1] = data[3];
+	snapshot->mode = data[4];
+	snapshot->mode_enable = data[5];
+	snapshot->valid |= TUXEDO_IO_TELEMETRY_VALID_FAN_DUTY(0) | TUXEDO_IO_TELEMETRY_VALID_FAN_DUTY(1) |
+			   TUXEDO_IO_TELEMETRY_VALID_FAN_TEMP(0) | TUXEDO_IO_TELEMETRY_VALID_FAN_TEMP(1) |
+			   TUXEDO_IO_TELEMETRY_VALID_MODE | TUXEDO_IO_TELEMETRY_VALID_MODE_ENABLE;
+}
+
+static void telemetry_collect(struct tuxedo_io_telemetry_t *snapshot, bool with_switches)
+{
+	struct tuxedo_io_shadow_t shadow;
+	bool shadow_fresh = shadow_copy_fresh(&shadow);
+
+	memset(snapshot, 0, sizeof(*snapshot));
+	snapshot->version = TUXEDO_IO_TELEMETRY_VERSION;
+
+	if (clevo_identify())
+		telemetry_clevo(snapshot, &shadow, shadow_fresh, with_switches);
+	else if (uniwill_identify())
+		telemetry_uniwill(snapshot, &shadow, shadow_fresh);
+}
+
+static long telemetry_ioctl_snapshot(unsigned long arg)
+{
+	struct tuxedo_io_telemetry_t snapshot;
+
+	telemetry_collect(&snapshot, true);
+
+	if (copy_to_user((void *) arg, &snapshot, sizeof(snapshot)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static int fop_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	int err;
+
+	if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > PAGE_SIZE)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+#else
+	vm_flags_mod(vma, VM_DONTEXPAND | VM_DONTDUMP, VM_MAYWRITE);
+#endif
+
+	err = remap_pfn_range(vma, vma->vm_start, virt_to_phys(tuxedo_io_shadow) >> PAGE_SHIFT,
+			      vma->vm_end - vma->vm_start, vma->vm_page_prot);
+	if (err)
+		return err;
+
+	vma->vm_ops = &shadow_vm_ops;
+	shadow_vm_open(vma);
+
+	return 0;
+}
+
+/*
+ * hwmon device
+ *
+ * pwmN (0-255), pwmN_enable (1 manual, 2 firmware auto) and tempN_input
+ * per fan. Values come from a cache refreshed at most every
+ * hwmon_cache_ms, so concurrent readers share one hardware read. There
+ * is no known fan speed (RPM) source, no fanN_input channels.
+ */
+#define HWMON_FANS		3
+#define HWMON_PWM_ENABLE_MANUAL	1
+#define HWMON_PWM_ENABLE_AUTO	2
+// Uniwill fan duty range
+#define UW_FAN_DUTY_MAX		0xc8
+
+static uint hwmon_cache_ms = 1000;
+module_param(hwmon_cache_ms, uint, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(hwmon_cache_ms, "Minimum interval between hardware reads for hwmon (default: 1000)");
+
+static struct hwmon_cache_t {
+	bool valid;
+	unsigned long updated;
+	struct tuxedo_io_telemetry_t snapshot;
+	u8 pwm_enable[HWMON_FANS];
+} hwmon_cache = {
+	.pwm_enable = { HWMON_PWM_ENABLE_AUTO, HWMON_PWM_ENABLE_AUTO, HWMON_PWM_ENABLE_AUTO },
+};
+
+static DEFINE_MUTEX(hwmon_cache_lock);
+static struct device *tuxedo_io_hwmon_dev;
+
+static int hwmon_fans(void)
+{
+	if (clevo_identify())
+		return ARRAY_SIZE(cl_faninfo_cmds);
+	if (uniwill_identify())
+		return ARRAY_SIZE(uw_fan_addresses);
+	return 0;
+}
+
+/**
+ * Refresh the cache if it is older than the interval, caller has to hold hwmon_cache_lock
+ */
+static void hwmon_cache_update(void)
+{
+	if (hwmon_cache.valid && time_before(jiffies, hwmon_cache.updated + msecs_to_jiffies(hwmon_cache_ms)))
+		return;
+
+	telemetry_collect(&hwmon_cache.snapshot, false);
+	hwmon_cache.updated = jiffies;
+	hwmon_cache.valid = true;
+}
+
+static u8 hwmon_duty_to_pwm(u8 duty)
+{
+	if (uniwill_identify())
+		return min_t(u32, duty, UW_FAN_DUTY_MAX) * 255 / UW_FAN_DUTY_MAX;
+	return duty;
+}
+
+static u8 hwmon_pwm_to_duty(u8 pwm)
+{
+	if (uniwill_identify())
+		return (u32) pwm * UW_FAN_DUTY_MAX / 255;
+	return pwm;
+}
+
+static umode_t hwmon_is_visible(const void *drvdata, enum hwmon_sensor_types type, u32 attr, int channel)
+{
+	int fans = hwmon_fans();
+
+	// Without an interface yet, offer all channels and check on access
+	if (fans > 0 && channel >= fans)
+		return 0;
+
+	switch (type) {
+	case hwmon_pwm:
+		return S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH;
+	case hwmon_temp:
+		return S_IRUSR | S_IRGRP | S_IROTH;
+	default:
+		return 0;
+	}
+}
+
+static int hwmon_read(struct device *dev, enum hwmon_sensor_types type, u32 attr, int channel, long *val)
+{
+	struct tuxedo_io_telemetry_t *snapshot = &hwmon_cache.snapshot;
+	int err = 0;
+
+	mutex_lock(&hwmon_cache_lock);
+	if (type == hwmon_pwm && attr == hwmon_pwm_enable) {
+		*val = hwmon_cache.pwm_enable[channel];
+		mutex_unlock(&hwmon_cache_lock);
+		return 0;
+	}
+
+	hwmon_cache_update();
+	if (type == hwmon_pwm && attr == hwmon_pwm_input &&
+	    (snapshot->valid & TUXEDO_IO_TELEMETRY_VALID_FAN_DUTY(channel)))
+		*val = hwmon_duty_to_pwm(snapshot->fan_duty[channel]);
+	else if (type == hwmon_temp && attr == hwmon_temp_input &&
+		 (snapshot->valid & TUXEDO_IO_TELEMETRY_VALID_FAN_TEMP(channel)))
+		*val = snapshot->fan_temp[channel] * 1000;
+	else
+		err = -ENODATA;
+	mutex_unlock(&hwmon_cache_lock);
+
+	return err;
+}
+
+static int hwmon_write_pwm(int channel, u8 pwm)
+{
+	u32 faninfo, argument = 0, status;
+	int i;
+
+	// A curve would override the manual value on its next tick
+	fan_control_release(channel);
+
+	if (uniwill_identify())
+		return uw_set_fan(channel, hwmon_pwm_to_duty(pwm));
+
+	// Clevo writes all fans at once, keep the current duty of the others
+	for (i = 0; i < ARRAY_SIZE(cl_faninfo_cmds); ++i) {
+		if (i == channel) {
+			faninfo = pwm;
+		} else {
+			status = cl_faninfo_read(i, &faninfo);
+			if (status != 0)
+				return (int) status;
+		}
+		argument |= (faninfo & 0xff) << (i * 8);
+	}
+
+	return cl_fanspeed_set(argument);
+}
+
+static int hwmon_write(struct device *dev, enum hwmon_sensor_types type, u32 attr, int channel, long val)
+{
+	int i, err = 0;
+
+	if (type != hwmon_pwm)
+		return -EOPNOTSUPP;
+	if (channel >= hwmon_fans())
+		return -ENODEV;
+
+	mutex_lock(&hwmon_cache_lock);
+	if (attr == hwmon_pwm_input) {
+		if (val < 0 || val > 255) {
+			err = -EINVAL;
+		} else {
+			err = hwmon_write_pwm(channel, val);
+			hwmon_cache.pwm_enable[channel] = HWMON_PWM_ENABLE_MANUAL;
+		}
+	} else if (attr == hwmon_pwm_enable) {
+		if (val == HWMON_PWM_ENABLE_MANUAL) {
+			hwmon_cache.pwm_enable[channel] = val;
+		} else if (val == HWMON_PWM_ENABLE_AUTO) {
+			// Firmware control applies to all fans
+			fan_control_stop();
+			if (uniwill_identify()) {
+				uw_set_fan_auto();
+			} else {
+				cl_fanspeed_forget();
+				clevo_evaluate_method(CLEVO_CMD_SET_FANSPEED_AUTO, 0, NULL);
+			}
+			for (i = 0; i < HWMON_FANS; ++i)
+				hwmon_cache.pwm_enable[i] = HWMON_PWM_ENABLE_AUTO;
+		} else {
+			err = -EINVAL;
+		}
+	} else {
+		err = -EOPNOTSUPP;
+	}
+	hwmon_cache.valid = false;
+	mutex_unlock(&hwmon_cache_lock);
+
+	return err;
+}
+
+static const struct hwmon_ops tuxedo_io_hwmon_ops = {
+	.is_visible = hwmon_is_visible,
+	.read = hwmon_read,
+	.write = hwmon_write,
+};
+
+static const u32 tuxedo_io_hwmon_pwm_config[] = {
+	HWMON_PWM_INPUT | HWMON_PWM_ENABLE,
+	HWMON_PWM_INPUT | HWMON_PWM_ENABLE,
+	HWMON_PWM_INPUT | HWMON_PWM_ENABLE,
+	0
+};
+
+static const struct hwmon_channel_info tuxedo_io_hwmon_pwm = {
+	.type = hwmon_pwm,
+	.config = tuxedo_io_hwmon_pwm_config,
+};
+
+static const u32 tuxedo_io_hwmon_temp_config[] = {
+	HWMON_T_INPUT,
+	HWMON_T_INPUT,
+	HWMON_T_INPUT,
+	0
+};
+
+static const struct hwmon_channel_info tuxedo_io_hwmon_temp = {
+	.type = hwmon_temp,
+	.config = tuxedo_io_hwmon_temp_config,
+};
+
+static const struct hwmon_channel_info *tuxedo_io_hwmon_info[] = {
+	&tuxedo_io_hwmon_pwm,
+	&tuxedo_io_hwmon_temp,
+	NULL
+};
+
+static const struct hwmon_chip_info tuxedo_io_hwmon_chip_info = {
+	.ops = &tuxedo_io_hwmon_ops,
+	.info = tuxedo_io_hwmon_info,
+};
+
+/*
+ * Thermal zones and cooling devices
+ *
+ * One zone per fan temperature with an active trip point, bound to the
+ * cooling device of the same fan. Temperatures come from the hwmon
+ * cache. Cooling state 0 leaves the fan to the firmware, states 1 and
+ * up map linearly to the fan duty and switch the fan to manual like a
+ * pwm write. Firmware control covers all fans, so it is only restored
+ * once every cooling device is back at state 0, until then a released
+ * fan keeps its last duty.
+ */
+#define THERMAL_COOLING_STATES	10
+#define THERMAL_TRIP_HYST_C	5
+
+static uint thermal_polling_ms = 2000;
+module_param(thermal_polling_ms, uint, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(thermal_polling_ms, "Thermal zone polling interval, load time only (default: 2000)");
+
+static uint thermal_trip_c = 75;
+module_param(thermal_trip_c, uint, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(thermal_trip_c, "Active trip point of the fan thermal zones, load time only (default: 75)");
+
+static bool thermal_enable = false;
+module_param(thermal_enable, bool, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(thermal_enable, "Register thermal zones and cooling devices for the fans (default: false)");
+
+static struct tuxedo_thermal_t {
+	int channel;
+	unsigned long state;
+	struct thermal_zone_device *tz;
+	struct thermal_cooling_device *cdev;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+	struct thermal_trip trip;
+#endif
+} tuxedo_thermal[HWMON_FANS];
+
+static DEFINE_MUTEX(tuxedo_thermal_lock);
+
+static struct tuxedo_thermal_t *thermal_zone_priv(struct thermal_zone_device *tz)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+	return thermal_zone_device_priv(tz);
+#else
+	return tz->devdata;
+#endif
+}
+
+static int thermal_get_temp(struct thermal_zone_device *tz, int *temp)
+{
+	struct tuxedo_thermal_t *zone = thermal_zone_priv(tz);
+	long val;
+	int err;
+
+	err = hwmon_read(NULL, hwmon_temp, hwmon_temp_input, zone->channel, &val);
+	if (err)
+		return err;
+	*temp = val;
+
+	return 0;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 12, 0)
+static bool thermal_should_bind(struct thermal_zone_device *tz, const struct thermal_trip *trip,
+				struct thermal_cooling_device *cdev, struct cooling_spec *c)
+{
+	return cdev == thermal_zone_priv(tz)->cdev;
+}
+#else
+static int thermal_bind(struct thermal_zone_device *tz, struct thermal_cooling_device *cdev)
+{
+	struct tuxedo_thermal_t *zone = thermal_zone_priv(tz);
+
+	if (cdev != zone->cdev)
+		return 0;
+
+	// Trip 0 is the only (active) trip of the zone
+	return thermal_zone_bind_cooling_device(tz, 0, cdev, THERMAL_NO_LIMIT, THERMAL_NO_LIMIT,
+						THERMAL_WEIGHT_DEFAULT);
+}
+
+static int thermal_unbind(struct thermal_zone_device *tz, struct thermal_cooling_device *cdev)
+{
+	struct tuxedo_thermal_t *zone = thermal_zone_priv(tz);
+
+	if (cdev != zone->cdev)
+		return 0;
+
+	return thermal_zone_unbind_cooling_device(tz, 0, cdev);
+}
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 0, 0)
+static int thermal_get_trip_type(struct thermal_zone_device *tz, int trip, enum thermal_trip_type *type)
+{
+	*type = THERMAL_TRIP_ACTIVE;
+	return 0;
+}
+
+static int thermal_get_trip_temp(struct thermal_zone_device *tz, int trip, int *temp)
+{
+	*temp = thermal_trip_c * 1000;
+	return 0;
+}
+
+static int thermal_get_trip_hyst(struct thermal_zone_device *tz, int trip, int *temp)
+{
+	*temp = THERMAL_TRIP_HYST_C * 1000;
+	return 0;
+}
+#endif
+
+static struct thermal_zone_device_ops tuxedo_thermal_zone_ops = {
+	.get_temp = thermal_get_temp,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 12, 0)
+	.should_bind = thermal_should_bind,
+#else
+	.bind = thermal_bind,
+	.unbind = thermal_unbind,
+#endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 0, 0)
+	.get_trip_type = thermal_get_trip_type,
+	.get_trip_temp = thermal_get_trip_temp,
+	.get_trip_hyst = thermal_get_trip_hyst,
+#endif
+};
+
+static int cooling_get_max_state(struct thermal_cooling_device *cdev, unsigned long *state)
+{
+	*state = THERMAL_COOLING_STATES;
+	return 0;
+}
+
+static int cooling_get_cur_state(struct thermal_cooling_device *cdev, unsigned long *state)
+{
+	struct tuxedo_thermal_t *zone = cdev->devdata;
+
+	*state = zone->state;
+	return 0;
+}
+
+static int cooling_set_cur_state(struct thermal_cooling_device *cdev, unsigned long state)
+{
+	struct tuxedo_thermal_t *zone = cdev->devdata;
+	bool active = false;
+	int i, err = 0;
+
+	if (state > THERMAL_COOLING_STATES)
+		return -EINVAL;
+
+	mutex_lock(&tuxedo_thermal_lock);
+	if (state > 0) {
+		err = hwmon_write(NULL, hwmon_pwm, hwmon_pwm_input, zone->channel,
+				  state * 255 / THERMAL_COOLING_STATES);
+	} else if (zone->state > 0) {
+		for (i = 0; i < HWMON_FANS; ++i)
+			active |= &tuxedo_thermal[i] != zone && tuxedo_thermal[i].state > 0;
+		if (!active)
+			err = hwmon_write(NULL, hwmon_pwm, hwmon_pwm_enable, zone->channel,
+					  HWMON_PWM_ENABLE_AUTO);
+	}
+	if (err == 0)
+		zone->state = state;
+	mutex_unlock(&tuxedo_thermal_lock);
+
+	return err;
+}
+
+static const struct thermal_cooling_device_ops tuxedo_cooling_ops = {
+	.get_max_state = cooling_get_max_state,
+	.get_cur_state = cooling_get_cur_state,
+	.set_cur_state = cooling_set_cur_state,
+};
+
+static void tuxedo_thermal_exit(void)
+{
+	int i;
+
+	for (i = 0; i < HWMON_FANS; ++i) {
+		if (!IS_ERR_OR_NULL(tuxedo_thermal[i].tz))
+			thermal_zone_device_unregister(tuxedo_thermal[i].tz);
+		tuxedo_thermal[i].tz = NULL;
+	}
+	for (i = 0; i < HWMON_FANS; ++i) {
+		if (!IS_ERR_OR_NULL(tuxedo_thermal[i].cdev))
+			thermal_cooling_device_unregister(tuxedo_thermal[i].cdev);
+		tuxedo_thermal[i].cdev = NULL;
+	}
+}
+
+static void tuxedo_thermal_init(void)
+{
+	struct tuxedo_thermal_t *zone;
+	char type[THERMAL_NAME_LENGTH];
+	int i, fans = hwmon_fans();
+
+	// Cooling devices first, zones bind to them on registration
+	for (i = 0; i < fans; ++i) {
+		zone = &tuxedo_thermal[i];
+		zone->channel = i;
+		snprintf(type, sizeof(type), "tuxedo_fan%d", i);
+		zone->cdev = thermal_cooling_device_register(type, zone, &tuxedo_cooling_ops);
+		if (IS_ERR(zone->cdev)) {
+			pr_err("Failed to register cooling device %s\n", type);
+			zone->cdev = NULL;
+		}
+	}
+
+	for (i = 0; i < fans; ++i) {
+		zone = &tuxedo_thermal[i];
+		snprintf(type, sizeof(type), "tuxedo_fan%d", i);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 0, 0)
+		zone->tz = thermal_zone_device_register(type, 1, 0, zone, &tuxedo_thermal_zone_ops,
+							NULL, 0, thermal_polling_ms);
+#else
+		zone->trip.type = THERMAL_TRIP_ACTIVE;
+		zone->trip.temperature = thermal_trip_c * 1000;
+		zone->trip.hysteresis = THERMAL_TRIP_HYST_C * 1000;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 9, 0)
+		zone->tz = thermal_zone_device_register_with_trips(type, &zone->trip, 1, 0, zone,
+								   &tuxedo_thermal_zone_ops, NULL, 0,
+								   thermal_polling_ms);
+#else
+		// The writable trips mask is gone
+		zone->tz = thermal_zone_device_register_with_trips(type, &zone->trip, 1, zone,
+								   &tuxedo_thermal_zone_ops, NULL, 0,
+								   thermal_polling_ms);
+#endif
+#endif
+		if (IS_ERR(zone->tz)) {
+			pr_err("Failed to register thermal zone %s\n", type);
+			zone->tz = NULL;
+			continue;
+		}
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+		thermal_zone_device_enable(zone->tz);
+#endif
+	}
+}
+
 static struct file_operations fops_dev = {
 	.owner              = THIS_MODULE,
-	.unlocked_ioctl     = fop_ioctl
-//	.open               = fop_open,
-//	.release            = fop_release
+	.unlocked_ioctl     = fop_ioctl,
+	.mmap               = fop_mmap,
+	.open               = fop_open,
+	.release            = fop_release,
+	.read               = fop_read,
+	.poll               = fop_poll,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+	.uring_cmd          = fop_uring_cmd,
+#endif
 };
 
 struct class *tuxedo_io_device_class;
 dev_t tuxedo_io_device_handle;
 
 static struct cdev tuxedo_io_cdev;
+static struct device *tuxedo_io_device;
 
 static int __init tuxedo_io_init(void)
 {
 	int err;
 
+	tuxedo_io_shadow = (struct tuxedo_io_shadow_t *) get_zeroed_page(GFP_KERNEL);
+	if (!tuxedo_io_shadow)
+		return -ENOMEM;
+	tuxedo_io_shadow->version = TUXEDO_IO_SHADOW_VERSION;
+	uw_fan_ramp_init();
+
 	// Hardware identification
 	id_check_clevo = clevo_identify();
 	id_check_uniwill = uniwill_identify();
@@ -388,6 +2179,7 @@ static int __init tuxedo_io_init(void)
 	err = alloc_chrdev_region(&tuxedo_io_device_handle, 0, 1, "tuxedo_io_cdev");
 	if (err != 0) {
 		pr_err("Failed to allocate chrdev region\n");
+		free_page((unsigned long) tuxedo_io_shadow);
 		return err;
 	}
 	cdev_init(&tuxedo_io_cdev, &fops_dev);
@@ -397,7 +2189,22 @@ static int __init tuxedo_io_init(void)
 		unregister_chrdev_region(tuxedo_io_device_handle, 1);
 	}
 	tuxedo_io_device_class = class_create(THIS_MODULE, "tuxedo_io");
-	device_create(tuxedo_io_device_class, NULL, tuxedo_io_device_handle, NULL, "tuxedo_io");
+	tuxedo_io_device = device_create(tuxedo_io_device_class, NULL, tuxedo_io_device_handle, NULL, "tuxedo_io");
+
+	// Registered regardless of hwmon_fans(), the interface module can load later
+	if (!IS_ERR_OR_NULL(tuxedo_io_device)) {
+		tuxedo_io_hwmon_dev = hwmon_device_register_with_info(tuxedo_io_device, "tuxedo", NULL,
+								      &tuxedo_io_hwmon_chip_info, NULL);
+		if (IS_ERR(tuxedo_io_hwmon_dev)) {
+			pr_err("Failed to register hwmon device\n");
+			tuxedo_io_hwmon_dev = NULL;
+		}
+	}
+
+	if (thermal_enable && hwmon_fans() > 0)
+		tuxedo_thermal_init();
+	tuxedo_event_register_notifier(&tuxedo_io_event_nb);
+	ioctl_stats_init();
 	pr_debug("Module init successful\n");
 	
 	return 0;
@@ -405,10 +2212,21 @@ static int __init tuxedo_io_init(void)
 
 static void __exit tuxedo_io_exit(void)
 {
+	debugfs_remove_recursive(tuxedo_io_debugfs);
+	tuxedo_thermal_exit();
+	if (tuxedo_io_hwmon_dev)
+		hwmon_device_unregister(tuxedo_io_hwmon_dev);
+	tuxedo_event_unregister_notifier(&tuxedo_io_event_nb);
 	device_destroy(tuxedo_io_device_class, tuxedo_io_device_handle);
 	class_destroy(tuxedo_io_device_class);
 	cdev_del(&tuxedo_io_cdev);
 	unregister_chrdev_region(tuxedo_io_device_handle, 1);
+	cancel_delayed_work_sync(&shadow_sample_work);
+	fan_control_stop();
+	cancel_delayed_work_sync(&fan_control_work);
+	cancel_delayed_work_sync(&cl_fanspeed_verify_work);
+	uw_fan_ramp_stop();
+	free_page((unsigned long) tuxedo_io_shadow);
 	pr_debug("Module exit\n");
 }
 
@@ -28,18 +28,159 @@
 #define MAGIC_WRITE_UW	IOCTL_MAGIC + 4
 
 
+/**
+ * Telemetry shadow page, mmap() of /dev/tuxedo_io (read-only, one page)
+ *
+ * Refreshed by the driver every telemetry_interval_ms while mapped. seq is
+ * odd during an update. Readers copy the structure and retry if seq was
+ * odd or changed meanwhile (read barriers around the copy).
+ */
+#define TUXEDO_IO_SHADOW_VERSION	1
+
+struct tuxedo_io_shadow_t {
+	uint32_t version;
+	uint32_t seq;
+	uint64_t timestamp_ns;	// CLOCK_MONOTONIC of the last sample
+	uint32_t interval_ms;
+	uint32_t samples;
+
+	// Uniwill EC RAM, valid if uw_status is 0
+	int32_t uw_status;
+	uint8_t uw_fanspeed;	// 0x1804
+	uint8_t uw_fanspeed2;	// 0x1809
+	uint8_t uw_fan_temp;	// 0x043e
+	uint8_t uw_fan_temp2;	// 0x044f
+	uint8_t uw_mode;	// 0x0751
+	uint8_t uw_mode_enable;	// 0x0741
+	uint8_t uw_reserved[2];
+
+	// Clevo FANINFO1-3 results, valid if cl_status is 0
+	int32_t cl_status;
+	uint32_t cl_faninfo[3];
+};
+
+/**
+ * Telemetry snapshot of the active backend, R_TELEMETRY_SNAPSHOT
+ *
+ * Only fields with their bit set in valid are filled. Fan duty and
+ * temperature are the raw vendor values (Clevo: FANINFO bits 0-7 and
+ * 16-23, Uniwill: EC RAM bytes). Values taken from the shadow page
+ * (see above) have TUXEDO_IO_TELEMETRY_FROM_SHADOW set in flags.
+ */
+#define TUXEDO_IO_TELEMETRY_VERSION	1
+#define TUXEDO_IO_TELEMETRY_FANS	3
+
+#define TUXEDO_IO_TELEMETRY_VENDOR_NONE		0
+#define TUXEDO_IO_TELEMETRY_VENDOR_CLEVO	1
+#define TUXEDO_IO_TELEMETRY_VENDOR_UNIWILL	2
+
+#define TUXEDO_IO_TELEMETRY_VALID_FAN_DUTY(n)	(1 << (n))
+#define TUXEDO_IO_TELEMETRY_VALID_FAN_TEMP(n)	(1 << (4 + (n)))
+#define TUXEDO_IO_TELEMETRY_VALID_MODE		(1 << 8)
+#define TUXEDO_IO_TELEMETRY_VALID_MODE_ENABLE	(1 << 9)
+#define TUXEDO_IO_TELEMETRY_VALID_WEBCAM_SW	(1 << 10)
+#define TUXEDO_IO_TELEMETRY_VALID_FLIGHTMODE_SW	(1 << 11)
+#define TUXEDO_IO_TELEMETRY_VALID_TOUCHPAD_SW	(1 << 12)
+
+#define TUXEDO_IO_TELEMETRY_FROM_SHADOW		(1 << 0)
+
+struct tuxedo_io_telemetry_t {
+	uint32_t version;
+	uint32_t vendor;
+	uint64_t timestamp_ns;	// CLOCK_MONOTONIC when the values were read
+	uint32_t valid;
+	uint32_t flags;
+	uint8_t fan_duty[TUXEDO_IO_TELEMETRY_FANS];
+	uint8_t fan_temp[TUXEDO_IO_TELEMETRY_FANS];
+	uint8_t mode;
+	uint8_t mode_enable;
+	uint8_t webcam_sw;
+	uint8_t flightmode_sw;
+	uint8_t touchpad_sw;
+	uint8_t reserved[5];
+};
+
+/**
+ * Event record, read() of /dev/tuxedo_io
+ *
+ * Each open file has its own queue. Reads return whole records only and
+ * block unless O_NONBLOCK is set, poll() signals readable records.
+ * dropped counts events lost on this file since the previous record
+ * because the queue was full.
+ */
+#define TUXEDO_IO_EVENT_SOURCE_CLEVO	1
+#define TUXEDO_IO_EVENT_SOURCE_UNIWILL	2
+
+struct tuxedo_io_event_t {
+	uint64_t timestamp_ns;	// CLOCK_MONOTONIC
+	uint32_t source;
+	uint32_t code;		// Vendor event code (e.g. Uniwill 0xab)
+	uint32_t dropped;
+	uint32_t reserved;
+};
+
+/**
+ * In-kernel fan curve controller, W_FAN_CURVE
+ *
+ * Uploads the temperature -> duty table for one fan (index 0-2 Clevo, 0-1
+ * Uniwill) of the active backend. Temperatures must be ascending, duty
+ * is the raw vendor value and interpolated linearly between points.
+ * The duty is only lowered once the temperature is hysteresis degrees
+ * below the point that would lower it, and changes by at most
+ * slew_up/slew_down per period (0 = unlimited). enable = 0 stops the
+ * controller for the fan, W_CL_FANAUTO/W_UW_FANAUTO stop all of them.
+ */
+#define TUXEDO_IO_FAN_CURVE_POINTS	8
+
+struct tuxedo_io_fan_curve_t {
+	uint32_t fan;
+	uint32_t enable;
+	uint32_t points;
+	struct {
+		uint8_t temp;
+		uint8_t duty;
+	} point[TUXEDO_IO_FAN_CURVE_POINTS];
+	uint8_t hysteresis;
+	uint8_t slew_up;
+	uint8_t slew_down;
+	uint8_t reserved;
+};
+
+/**
+ * io_uring passthrough (IORING_OP_URING_CMD, kernel 5.19+)
+ *
+ * sqe->cmd_op is one of the R_CL_* / W_CL_* / R_UW_* / W_UW_* commands
+ * taking or returning a single 32-bit value, the sqe->cmd payload is
+ * below. The ring has to be set up with IORING_SETUP_CQE32, otherwise
+ * the request fails with -EINVAL. Requests run asynchronously and
+ * complete out of order with cqe->res = 0 or negative errno and the read
+ * value in cqe->big_cqe[0]. Commands that transfer strings or structs
+ * are only available via ioctl.
+ */
+struct tuxedo_io_uring_cmd_t {
+	uint32_t argument;	// Value for W_* commands, ignored for R_*
+	uint32_t reserved;
+};
+
 // General
 #define R_MOD_VERSION		_IOR(IOCTL_MAGIC, 0x00, char*)
 
 #define R_HWCHECK_CL		_IOR(IOCTL_MAGIC, 0x05, int32_t*)
 #define R_HWCHECK_UW		_IOR(IOCTL_MAGIC, 0x06, int32_t*)
 
+#define R_TELEMETRY_SNAPSHOT	_IOR(IOCTL_MAGIC, 0x10, struct tuxedo_io_telemetry_t)
+#define W_FAN_CURVE		_IOW(IOCTL_MAGIC, 0x11, struct tuxedo_io_fan_curve_t)
+
 /**
  * Clevo interface
  */
 
 // Read
 #define R_CL_HW_IF_STR		_IOR(MAGIC_READ_CL, 0x00, char*)
+// FANINFO duty (bits 0-7) is the target of a W_CL_FANSPEED that has not
+// settled yet if CL_FANINFO_PENDING is set
+#define CL_FANINFO_PENDING	(1u << 31)
+
 #define R_CL_FANINFO1		_IOR(MAGIC_READ_CL, 0x10, int32_t*)
 #define R_CL_FANINFO2		_IOR(MAGIC_READ_CL, 0x11, int32_t*)
 #define R_CL_FANINFO3		_IOR(MAGIC_READ_CL, 0x12, int32_t*)
@@ -80,11 +221,59 @@
 #define R_UW_MODE		_IOR(MAGIC_READ_UW, 0x14, int32_t*)
 #define R_UW_MODE_ENABLE	_IOR(MAGIC_READ_UW, 0x15, int32_t*)
 
+/**
+ * Read a list of EC RAM address ranges in one call
+ *
+ * In: count, range[0..count-1]
+ * Out: status (0 or negative error), data_length, data (the bytes of all
+ * ranges concatenated in request order)
+ */
+#define UW_EC_RANGES_MAX	16
+#define UW_EC_RANGES_MAX_BYTES	64
+
+struct uw_ec_ranges_t {
+	uint32_t count;
+	struct {
+		uint16_t addr;
+		uint16_t length;
+	} range[UW_EC_RANGES_MAX];
+	int32_t status;
+	uint32_t data_length;
+	uint8_t data[UW_EC_RANGES_MAX_BYTES];
+};
+
+#define R_UW_EC_RANGES		_IOWR(MAGIC_READ_UW, 0x20, struct uw_ec_ranges_t)
+
+/**
+ * EC manual mode fan curve (EC RAM 0x0743 - 0x0747)
+ *
+ * Read: curve as read back from the EC, the EC default curve
+ * (0x0786 - 0x078a) and the manual mode byte (0x0741)
+ * Write: curve only, values must be non-decreasing. Enables manual mode
+ * and verifies the written values, -EIO if the EC does not keep them.
+ */
+#define UW_FAN_CURVE_LENGTH	5
+
+struct uw_fan_curve_t {
+	uint8_t curve[UW_FAN_CURVE_LENGTH];
+	uint8_t default_curve[UW_FAN_CURVE_LENGTH];
+	uint8_t manual_mode;
+	uint8_t reserved;
+};
+
+#define R_UW_FAN_CURVE		_IOR(MAGIC_READ_UW, 0x21, struct uw_fan_curve_t)
+
 // Write
 #define W_UW_FANSPEED		_IOW(MAGIC_WRITE_UW, 0x10, int32_t*)
 #define W_UW_FANSPEED2		_IOW(MAGIC_WRITE_UW, 0x11, int32_t*)
 #define W_UW_MODE		_IOW(MAGIC_WRITE_UW, 0x12, int32_t*)
 #define W_UW_MODE_ENABLE	_IOW(MAGIC_WRITE_UW, 0x13, int32_t*)
 #define W_UW_FANAUTO	_IO(MAGIC_WRITE_UW, 0x14) // undo all previous calls of W_UW_FANSPEED and W_UW_FANSPEED2
+#define W_UW_FAN_CURVE		_IOW(MAGIC_WRITE_UW, 0x21, struct uw_fan_curve_t)
+
+#ifdef DEBUG
+// Same layout as R_UW_EC_RANGES, data is input
+#define W_UW_EC_RANGES		_IOWR(MAGIC_WRITE_UW, 0x20, struct uw_ec_ranges_t)
+#endif
 
 #endif
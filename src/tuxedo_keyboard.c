@@ -23,6 +23,34 @@
 #include "uniwill_keyboard.h"
 #include <linux/mutex.h>
 
+#define CREATE_TRACE_POINTS
+#include "tuxedo_trace.h"
+
+EXPORT_TRACEPOINT_SYMBOL_GPL(clevo_wmi_evaluate);
+EXPORT_TRACEPOINT_SYMBOL_GPL(clevo_acpi_evaluate);
+EXPORT_TRACEPOINT_SYMBOL_GPL(uw_ec_read_addr_direct);
+EXPORT_TRACEPOINT_SYMBOL_GPL(uw_ec_write_addr_direct);
+EXPORT_TRACEPOINT_SYMBOL_GPL(uw_wmi_ec_evaluate);
+
+static ATOMIC_NOTIFIER_HEAD(tuxedo_event_notifier);
+
+int tuxedo_event_register_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_register(&tuxedo_event_notifier, nb);
+}
+EXPORT_SYMBOL(tuxedo_event_register_notifier);
+
+int tuxedo_event_unregister_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_unregister(&tuxedo_event_notifier, nb);
+}
+EXPORT_SYMBOL(tuxedo_event_unregister_notifier);
+
+void tuxedo_event_notify(u32 source, u32 code)
+{
+	atomic_notifier_call_chain(&tuxedo_event_notifier, source, &code);
+}
+
 MODULE_AUTHOR("TUXEDO Computers GmbH <tux@tuxedocomputers.com>");
 MODULE_DESCRIPTION("TUXEDO Computers keyboard & keyboard backlight Driver");
 MODULE_LICENSE("GPL");
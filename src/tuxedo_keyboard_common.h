@@ -26,6 +26,7 @@
 #include <linux/platform_device.h>
 #include <linux/input.h>
 #include <linux/input/sparse-keymap.h>
+#include "tuxedo_events.h"
 
 /* ::::  Module specific Constants and simple Macros   :::: */
 #define __TUXEDO_PR(lvl, fmt, ...) do { pr_##lvl(fmt, ##__VA_ARGS__); } while (0)
@@ -0,0 +1,152 @@
+/*!
+ * Copyright (c) 2021 TUXEDO Computers GmbH <tux@tuxedocomputers.com>
+ *
+ * This file is part of tuxedo-keyboard.
+ *
+ * tuxedo-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Trace events for firmware calls
+ *
+ * Defined in tuxedo_keyboard (CREATE_TRACE_POINTS) and exported for the
+ * interface modules. Times are in ns, hw_ns is the time spent in the
+ * firmware call itself, lock_ns the time waited for the EC lock before.
+ * The Clevo paths have no driver side lock.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM tuxedo
+
+#if !defined(TUXEDO_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define TUXEDO_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(tuxedo_clevo_call,
+
+	TP_PROTO(u8 cmd, u32 arg, u32 result, int status, u64 hw_ns),
+
+	TP_ARGS(cmd, arg, result, status, hw_ns),
+
+	TP_STRUCT__entry(
+		__field(u8, cmd)
+		__field(u32, arg)
+		__field(u32, result)
+		__field(int, status)
+		__field(u64, hw_ns)
+	),
+
+	TP_fast_assign(
+		__entry->cmd = cmd;
+		__entry->arg = arg;
+		__entry->result = result;
+		__entry->status = status;
+		__entry->hw_ns = hw_ns;
+	),
+
+	TP_printk("cmd=0x%02x arg=0x%08x result=0x%08x status=%d hw_ns=%llu",
+		  __entry->cmd, __entry->arg, __entry->result, __entry->status,
+		  __entry->hw_ns)
+);
+
+DEFINE_EVENT(tuxedo_clevo_call, clevo_evaluate_method,
+	TP_PROTO(u8 cmd, u32 arg, u32 result, int status, u64 hw_ns),
+	TP_ARGS(cmd, arg, result, status, hw_ns)
+);
+
+DEFINE_EVENT(tuxedo_clevo_call, clevo_wmi_evaluate,
+	TP_PROTO(u8 cmd, u32 arg, u32 result, int status, u64 hw_ns),
+	TP_ARGS(cmd, arg, result, status, hw_ns)
+);
+
+DEFINE_EVENT(tuxedo_clevo_call, clevo_acpi_evaluate,
+	TP_PROTO(u8 cmd, u32 arg, u32 result, int status, u64 hw_ns),
+	TP_ARGS(cmd, arg, result, status, hw_ns)
+);
+
+DECLARE_EVENT_CLASS(tuxedo_uw_ec_access,
+
+	TP_PROTO(u16 addr, u16 data, int status, u64 lock_ns, u64 hw_ns),
+
+	TP_ARGS(addr, data, status, lock_ns, hw_ns),
+
+	TP_STRUCT__entry(
+		__field(u16, addr)
+		__field(u16, data)
+		__field(int, status)
+		__field(u64, lock_ns)
+		__field(u64, hw_ns)
+	),
+
+	TP_fast_assign(
+		__entry->addr = addr;
+		__entry->data = data;
+		__entry->status = status;
+		__entry->lock_ns = lock_ns;
+		__entry->hw_ns = hw_ns;
+	),
+
+	TP_printk("addr=0x%04x data=0x%04x status=%d lock_ns=%llu hw_ns=%llu",
+		  __entry->addr, __entry->data, __entry->status,
+		  __entry->lock_ns, __entry->hw_ns)
+);
+
+DEFINE_EVENT(tuxedo_uw_ec_access, uw_ec_read_addr_direct,
+	TP_PROTO(u16 addr, u16 data, int status, u64 lock_ns, u64 hw_ns),
+	TP_ARGS(addr, data, status, lock_ns, hw_ns)
+);
+
+DEFINE_EVENT(tuxedo_uw_ec_access, uw_ec_write_addr_direct,
+	TP_PROTO(u16 addr, u16 data, int status, u64 lock_ns, u64 hw_ns),
+	TP_ARGS(addr, data, status, lock_ns, hw_ns)
+);
+
+TRACE_EVENT(uw_wmi_ec_evaluate,
+
+	TP_PROTO(u16 addr, u16 data, bool read, u32 result, int status, u64 lock_ns, u64 hw_ns),
+
+	TP_ARGS(addr, data, read, result, status, lock_ns, hw_ns),
+
+	TP_STRUCT__entry(
+		__field(u16, addr)
+		__field(u16, data)
+		__field(bool, read)
+		__field(u32, result)
+		__field(int, status)
+		__field(u64, lock_ns)
+		__field(u64, hw_ns)
+	),
+
+	TP_fast_assign(
+		__entry->addr = addr;
+		__entry->data = data;
+		__entry->read = read;
+		__entry->result = result;
+		__entry->status = status;
+		__entry->lock_ns = lock_ns;
+		__entry->hw_ns = hw_ns;
+	),
+
+	TP_printk("%s addr=0x%04x data=0x%04x result=0x%08x status=%d lock_ns=%llu hw_ns=%llu",
+		  __entry->read ? "read" : "write", __entry->addr, __entry->data,
+		  __entry->result, __entry->status, __entry->lock_ns, __entry->hw_ns)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE tuxedo_trace
+#include <trace/define_trace.h>
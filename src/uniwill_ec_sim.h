@@ -0,0 +1,124 @@
+/*!
+ * Copyright (c) 2021 TUXEDO Computers GmbH <tux@tuxedocomputers.com>
+ *
+ * This file is part of tuxedo-keyboard.
+ *
+ * tuxedo-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Software model of the Uniwill EC handshake, included by uniwill_wmi.c
+ *
+ * Emulates the LDAT/HDAT/CMDL/CMDH/FLAGS registers on top of a plain EC
+ * RAM array. Every transaction becomes ready (DRDY) after a configurable
+ * latency plus random jitter, failure injection lets transactions never
+ * become ready. Used instead of the ACPI EC when loaded with ec_sim=1,
+ * no WMI GUIDs are needed then.
+ */
+#ifndef UNIWILL_EC_SIM_H
+#define UNIWILL_EC_SIM_H
+
+#include <linux/random.h>
+
+#define UW_EC_SIM_RAM_SIZE	0x10000
+
+static bool uniwill_ec_sim = false;
+static uint uw_ec_sim_latency_us = 100;
+static uint uw_ec_sim_jitter_us = 50;
+static uint uw_ec_sim_fail_pm = 0;
+
+/*
+ * Simulated EC state, protected by uniwill_ec_lock like the real
+ * handshake
+ */
+static struct uw_ec_sim_t {
+	u8 regs[0x100];
+	u8 ram[UW_EC_SIM_RAM_SIZE];
+	bool pending;
+	bool failing;
+	ktime_t ready_at;
+	u32 transactions;
+	u32 failures;
+} uw_ec_sim;
+
+static void uw_ec_sim_start(u8 flags)
+{
+	u16 addr = (uw_ec_sim.regs[UNIWILL_EC_REG_HDAT] << 8) | uw_ec_sim.regs[UNIWILL_EC_REG_LDAT];
+	u32 delay_us = uw_ec_sim_latency_us;
+
+	if (uw_ec_sim_jitter_us > 0)
+		delay_us += get_random_u32() % (uw_ec_sim_jitter_us + 1);
+
+	uw_ec_sim.transactions += 1;
+	uw_ec_sim.pending = true;
+	uw_ec_sim.ready_at = ktime_add_us(ktime_get(), delay_us);
+	uw_ec_sim.failing = uw_ec_sim_fail_pm > 0 && (get_random_u32() % 1000) < uw_ec_sim_fail_pm;
+
+	if (uw_ec_sim.failing) {
+		uw_ec_sim.failures += 1;
+		return;
+	}
+
+	if (flags & (1 << UNIWILL_EC_BIT_WFLG)) {
+		uw_ec_sim.ram[addr] = uw_ec_sim.regs[UNIWILL_EC_REG_CMDL];
+	} else {
+		uw_ec_sim.regs[UNIWILL_EC_REG_CMDL] = uw_ec_sim.ram[addr];
+		uw_ec_sim.regs[UNIWILL_EC_REG_CMDH] = 0x00;
+	}
+}
+
+static int uw_ec_sim_read(u8 reg, u8 *val)
+{
+	if (reg == UNIWILL_EC_REG_FLAGS && uw_ec_sim.pending && !uw_ec_sim.failing &&
+	    !ktime_before(ktime_get(), uw_ec_sim.ready_at))
+		uw_ec_sim.regs[UNIWILL_EC_REG_FLAGS] |= (1 << UNIWILL_EC_BIT_DRDY);
+
+	*val = uw_ec_sim.regs[reg];
+
+	return 0;
+}
+
+static int uw_ec_sim_write(u8 reg, u8 val)
+{
+	uw_ec_sim.regs[reg] = val;
+
+	if (reg == UNIWILL_EC_REG_FLAGS) {
+		uw_ec_sim.pending = false;
+		if (val & ((1 << UNIWILL_EC_BIT_RFLG) | (1 << UNIWILL_EC_BIT_WFLG)))
+			uw_ec_sim_start(val);
+	}
+
+	return 0;
+}
+
+static const struct uniwill_ec_port_ops uw_ec_port_sim = {
+	.name = "sim",
+	.read = uw_ec_sim_read,
+	.write = uw_ec_sim_write,
+};
+
+module_param_named(ec_sim, uniwill_ec_sim, bool, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(ec_sim, "Use a simulated EC instead of the hardware, load time only (default: false)");
+module_param_named(ec_sim_latency_us, uw_ec_sim_latency_us, uint, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(ec_sim_latency_us, "Simulated EC transaction latency in us (default: 100)");
+module_param_named(ec_sim_jitter_us, uw_ec_sim_jitter_us, uint, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(ec_sim_jitter_us, "Maximum random additional latency in us (default: 50)");
+module_param_named(ec_sim_fail_pm, uw_ec_sim_fail_pm, uint, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(ec_sim_fail_pm, "Simulated transactions timing out, per mille (default: 0)");
+module_param_named(ec_sim_transactions, uw_ec_sim.transactions, uint, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(ec_sim_transactions, "Transactions started on the simulated EC (read-only)");
+module_param_named(ec_sim_failures, uw_ec_sim.failures, uint, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(ec_sim_failures, "Injected simulated EC failures (read-only)");
+
+#endif
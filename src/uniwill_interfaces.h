@@ -20,6 +20,7 @@
 #define UNIWILL_INTERFACES_H
 
 #include <linux/types.h>
+#include <linux/list.h>
 
 #define UNIWILL_WMI_MGMT_GUID_BA	"ABBC0F6D-8EA1-11D1-00A0-C90629100000"
 #define UNIWILL_WMI_MGMT_GUID_BB	"ABBC0F6E-8EA1-11D1-00A0-C90629100000"
@@ -35,21 +36,82 @@
 
 #define UNIWILL_INTERFACE_WMI_STRID "uniwill_wmi"
 
+// EC RAM addresses
+#define UW_EC_RAM_KBD_BL_STATUS		0x078c
+#define UW_EC_RAM_KBD_BL_RGB_RED	0x1803
+#define UW_EC_RAM_KBD_BL_RGB_GREEN	0x1805
+#define UW_EC_RAM_KBD_BL_RGB_BLUE	0x1808
+
+#define UW_EC_RAM_LIGHTBAR_ANIMATION	0x0748
+#define UW_EC_RAM_LIGHTBAR_RED		0x0749
+#define UW_EC_RAM_LIGHTBAR_GREEN	0x074a
+#define UW_EC_RAM_LIGHTBAR_BLUE		0x074b
+
+#define UW_EC_RAM_FAN0_PWM		0x1804
+#define UW_EC_RAM_FAN1_PWM		0x1809
+#define UW_EC_RAM_FAN0_TEMP		0x043e
+#define UW_EC_RAM_FAN1_TEMP		0x044f
+
+#define UW_EC_RAM_MANUAL_MODE		0x0741
+#define UW_EC_RAM_FAN_CURVE		0x0743
+#define UW_EC_RAM_FAN_CURVE_DEFAULT	0x0786
+#define UW_EC_RAM_FAN_CURVE_LENGTH	5
+#define UW_EC_RAM_MODE			0x0751
+#define UW_EC_MODE_FULL_FAN		0x40
+
 typedef u32 (uniwill_read_ec_ram_t)(u16, u8*);
 typedef u32 (uniwill_write_ec_ram_t)(u16, u8);
+typedef u32 (uniwill_read_ec_ram_multi_t)(const u16 *, u8 *, u32);
+typedef u32 (uniwill_write_ec_ram_multi_t)(const u16 *, const u8 *, u32);
 typedef void (uniwill_event_callb_t)(u32);
 
+// EC transaction priority classes, lower value is served first
+enum uniwill_ec_prio {
+	UW_EC_PRIO_INPUT = 0,
+	UW_EC_PRIO_FAN,
+	UW_EC_PRIO_TELEMETRY,
+	UW_EC_PRIO_LIGHTING,
+	UW_EC_PRIO_COUNT
+};
+
+struct uniwill_ec_txn {
+	struct list_head list;
+	u8 prio;
+	bool write;
+	const u16 *addr;
+	u8 *data;
+	u32 count;
+	u32 status;
+	void (*complete)(struct uniwill_ec_txn *txn);
+	void *context;
+};
+
 struct uniwill_interface_t {
 	char *string_id;
 	uniwill_event_callb_t *event_callb;
 	uniwill_read_ec_ram_t *read_ec_ram;
 	uniwill_write_ec_ram_t *write_ec_ram;
+	// Optional, access a list of addresses in one go
+	uniwill_read_ec_ram_multi_t *read_ec_ram_multi;
+	uniwill_write_ec_ram_multi_t *write_ec_ram_multi;
 };
 
 u32 uniwill_add_interface(struct uniwill_interface_t *new_interface);
 u32 uniwill_remove_interface(struct uniwill_interface_t *interface);
 uniwill_read_ec_ram_t uniwill_read_ec_ram;
 uniwill_write_ec_ram_t uniwill_write_ec_ram;
+uniwill_read_ec_ram_multi_t uniwill_read_ec_ram_multi;
+uniwill_write_ec_ram_multi_t uniwill_write_ec_ram_multi;
+uniwill_read_ec_ram_t uniwill_read_ec_ram_nocache;
+uniwill_write_ec_ram_t uniwill_write_ec_ram_deferred;
+u32 uniwill_sync_ec_ram(u8 prio);
+u32 uniwill_read_ec_ram_prio(u16 address, u8 *data, u8 prio);
+u32 uniwill_read_ec_ram_multi_prio(const u16 *addresses, u8 *data, u32 count, u8 prio);
+u32 uniwill_write_ec_ram_multi_prio(const u16 *addresses, const u8 *data, u32 count, u8 prio);
+u32 uniwill_write_ec_ram_prio(u16 address, u8 data, u8 prio);
+u32 uniwill_write_ec_ram_async(u16 address, u8 data, u8 prio);
+u32 uniwill_ec_submit(struct uniwill_ec_txn *txn);
+void uniwill_invalidate_ec_ram_cache(void);
 u32 uniwill_get_active_interface_id(char **id_str);
 
 union uw_ec_read_return {
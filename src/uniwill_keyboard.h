@@ -26,6 +26,9 @@
 #include <linux/leds.h>
 #include <linux/string.h>
 #include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+#include <linux/led-class-multicolor.h>
+#endif
 #include "uniwill_interfaces.h"
 
 #define UNIWILL_WMI_MGMT_GUID_BA "ABBC0F6D-8EA1-11D1-00A0-C90629100000"
@@ -94,7 +97,10 @@ static struct uniwill_interfaces_t {
 
 uniwill_event_callb_t uniwill_event_callb;
 
-u32 uniwill_read_ec_ram(u16 address, u8 *data)
+/*
+ * Hardware access through the active interface
+ */
+static u32 uniwill_hw_read_ec_ram(u16 address, u8 *data)
 {
 	u32 status;
 
@@ -107,9 +113,8 @@ u32 uniwill_read_ec_ram(u16 address, u8 *data)
 
 	return status;
 }
-EXPORT_SYMBOL(uniwill_read_ec_ram);
 
-u32 uniwill_write_ec_ram(u16 address, u8 data)
+static u32 uniwill_hw_write_ec_ram(u16 address, u8 data)
 {
 	u32 status;
 
@@ -122,8 +127,478 @@ u32 uniwill_write_ec_ram(u16 address, u8 data)
 
 	return status;
 }
+
+static u32 uniwill_hw_read_ec_ram_multi(const u16 *addresses, u8 *data, u32 count)
+{
+	u32 i, status;
+
+	if (IS_ERR_OR_NULL(uniwill_interfaces.wmi)) {
+		pr_err("no active interface while read of %d addresses\n", count);
+		return -EIO;
+	}
+
+	if (!IS_ERR_OR_NULL(uniwill_interfaces.wmi->read_ec_ram_multi))
+		return uniwill_interfaces.wmi->read_ec_ram_multi(addresses, data, count);
+
+	// Fall back to single reads for interfaces without list support
+	status = 0;
+	for (i = 0; i < count; ++i) {
+		if (uniwill_interfaces.wmi->read_ec_ram(addresses[i], &data[i]) != 0)
+			status = -EIO;
+	}
+
+	return status;
+}
+
+static u32 uniwill_hw_write_ec_ram_multi(const u16 *addresses, const u8 *data, u32 count)
+{
+	u32 i, status;
+
+	if (IS_ERR_OR_NULL(uniwill_interfaces.wmi)) {
+		pr_err("no active interface while write of %d addresses\n", count);
+		return -EIO;
+	}
+
+	if (!IS_ERR_OR_NULL(uniwill_interfaces.wmi->write_ec_ram_multi))
+		return uniwill_interfaces.wmi->write_ec_ram_multi(addresses, data, count);
+
+	status = 0;
+	for (i = 0; i < count; ++i) {
+		if (uniwill_interfaces.wmi->write_ec_ram(addresses[i], data[i]) != 0)
+			status = -EIO;
+	}
+
+	return status;
+}
+
+/*
+ * EC RAM register map
+ *
+ * Registers only changed by this driver are cached: reads are served
+ * from the cache once the value is known and writes can be collected
+ * and synced to the EC in one go. Volatile registers (and all addresses
+ * not listed) always go to the hardware.
+ */
+struct uniwill_ec_reg_t {
+	u16 addr;
+	bool is_volatile;
+	bool valid;
+	bool dirty;
+	u8 value;
+};
+
+#define UW_EC_REG_CACHED(address)	{ .addr = (address), .is_volatile = false }
+#define UW_EC_REG_VOLATILE(address)	{ .addr = (address), .is_volatile = true }
+
+static struct uniwill_ec_reg_t uniwill_ec_regs[] = {
+	// Keyboard backlight
+	UW_EC_REG_VOLATILE(UW_EC_RAM_KBD_BL_STATUS),
+	UW_EC_REG_CACHED(UW_EC_RAM_KBD_BL_RGB_RED),
+	UW_EC_REG_CACHED(UW_EC_RAM_KBD_BL_RGB_GREEN),
+	UW_EC_REG_CACHED(UW_EC_RAM_KBD_BL_RGB_BLUE),
+	// Lightbar (in write order for uniwill_sync_ec_ram)
+	UW_EC_REG_CACHED(UW_EC_RAM_LIGHTBAR_RED),
+	UW_EC_REG_CACHED(UW_EC_RAM_LIGHTBAR_GREEN),
+	UW_EC_REG_CACHED(UW_EC_RAM_LIGHTBAR_BLUE),
+	UW_EC_REG_CACHED(UW_EC_RAM_LIGHTBAR_ANIMATION),
+	// Fan control
+	UW_EC_REG_VOLATILE(UW_EC_RAM_FAN0_PWM),
+	UW_EC_REG_VOLATILE(UW_EC_RAM_FAN1_PWM),
+	UW_EC_REG_VOLATILE(UW_EC_RAM_FAN0_TEMP),
+	UW_EC_REG_VOLATILE(UW_EC_RAM_FAN1_TEMP),
+	UW_EC_REG_CACHED(UW_EC_RAM_MODE),
+	UW_EC_REG_CACHED(UW_EC_RAM_MANUAL_MODE),
+	UW_EC_REG_CACHED(UW_EC_RAM_FAN_CURVE + 0),
+	UW_EC_REG_CACHED(UW_EC_RAM_FAN_CURVE + 1),
+	UW_EC_REG_CACHED(UW_EC_RAM_FAN_CURVE + 2),
+	UW_EC_REG_CACHED(UW_EC_RAM_FAN_CURVE + 3),
+	UW_EC_REG_CACHED(UW_EC_RAM_FAN_CURVE + 4),
+};
+
+static DEFINE_SPINLOCK(uniwill_ec_cache_lock);
+
+static struct uniwill_ec_reg_t *uniwill_ec_reg_cached(u16 address)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(uniwill_ec_regs); ++i) {
+		if (uniwill_ec_regs[i].addr == address)
+			return uniwill_ec_regs[i].is_volatile ? NULL : &uniwill_ec_regs[i];
+	}
+
+	return NULL;
+}
+
+static bool uniwill_ec_cache_get(u16 address, u8 *data)
+{
+	struct uniwill_ec_reg_t *reg = uniwill_ec_reg_cached(address);
+	unsigned long flags;
+	bool hit = false;
+
+	if (reg == NULL)
+		return false;
+
+	spin_lock_irqsave(&uniwill_ec_cache_lock, flags);
+	if (reg->valid) {
+		*data = reg->value;
+		hit = true;
+	}
+	spin_unlock_irqrestore(&uniwill_ec_cache_lock, flags);
+
+	return hit;
+}
+
+/**
+ * Update cache after a hardware access, a failed access (status != 0)
+ * invalidates the entry
+ */
+static void uniwill_ec_cache_put(u16 address, u8 data, u32 status, bool from_read)
+{
+	struct uniwill_ec_reg_t *reg = uniwill_ec_reg_cached(address);
+	unsigned long flags;
+
+	if (reg == NULL)
+		return;
+
+	spin_lock_irqsave(&uniwill_ec_cache_lock, flags);
+	if (status != 0) {
+		reg->valid = false;
+	} else if (!from_read || !reg->valid) {
+		// Values read back never replace a newer value from a write
+		reg->value = data;
+		reg->valid = true;
+	}
+	if (!from_read)
+		reg->dirty = false;
+	spin_unlock_irqrestore(&uniwill_ec_cache_lock, flags);
+}
+
+/**
+ * Forget all cached values, for example when the EC state might have
+ * been reset behind our back (resume, keyboard backlight reset)
+ */
+void uniwill_invalidate_ec_ram_cache(void)
+{
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&uniwill_ec_cache_lock, flags);
+	for (i = 0; i < ARRAY_SIZE(uniwill_ec_regs); ++i) {
+		uniwill_ec_regs[i].valid = false;
+		uniwill_ec_regs[i].dirty = false;
+	}
+	spin_unlock_irqrestore(&uniwill_ec_cache_lock, flags);
+}
+EXPORT_SYMBOL(uniwill_invalidate_ec_ram_cache);
+
+/*
+ * EC transaction executor
+ *
+ * All hardware accesses are queued by priority class and executed one
+ * transaction at a time from a single work item, so that a burst of
+ * low priority accesses only delays a more important one by at most
+ * the transaction currently running.
+ */
+static struct list_head uniwill_ec_queues[UW_EC_PRIO_COUNT] = {
+	LIST_HEAD_INIT(uniwill_ec_queues[UW_EC_PRIO_INPUT]),
+	LIST_HEAD_INIT(uniwill_ec_queues[UW_EC_PRIO_FAN]),
+	LIST_HEAD_INIT(uniwill_ec_queues[UW_EC_PRIO_TELEMETRY]),
+	LIST_HEAD_INIT(uniwill_ec_queues[UW_EC_PRIO_LIGHTING]),
+};
+static DEFINE_SPINLOCK(uniwill_ec_queue_lock);
+
+static struct uniwill_ec_txn *uniwill_ec_dequeue(void)
+{
+	struct uniwill_ec_txn *txn = NULL;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&uniwill_ec_queue_lock, flags);
+	for (i = 0; i < UW_EC_PRIO_COUNT; ++i) {
+		if (!list_empty(&uniwill_ec_queues[i])) {
+			txn = list_first_entry(&uniwill_ec_queues[i], struct uniwill_ec_txn, list);
+			list_del_init(&txn->list);
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&uniwill_ec_queue_lock, flags);
+
+	return txn;
+}
+
+static void uniwill_ec_execute(struct uniwill_ec_txn *txn)
+{
+	u32 i;
+
+	if (txn->write) {
+		if (txn->count == 1)
+			txn->status = uniwill_hw_write_ec_ram(txn->addr[0], txn->data[0]);
+		else
+			txn->status = uniwill_hw_write_ec_ram_multi(txn->addr, txn->data, txn->count);
+	} else {
+		if (txn->count == 1)
+			txn->status = uniwill_hw_read_ec_ram(txn->addr[0], &txn->data[0]);
+		else
+			txn->status = uniwill_hw_read_ec_ram_multi(txn->addr, txn->data, txn->count);
+	}
+
+	for (i = 0; i < txn->count; ++i)
+		uniwill_ec_cache_put(txn->addr[i], txn->data[i], txn->status, !txn->write);
+}
+
+static void uniwill_ec_executor_func(struct work_struct *work)
+{
+	struct uniwill_ec_txn *txn;
+
+	while ((txn = uniwill_ec_dequeue()) != NULL) {
+		uniwill_ec_execute(txn);
+		// Note: txn can be freed by the completion callback
+		if (txn->complete)
+			txn->complete(txn);
+	}
+}
+
+static DECLARE_WORK(uniwill_ec_executor, uniwill_ec_executor_func);
+
+/**
+ * Queue an EC transaction, can be called from atomic context
+ *
+ * txn->complete is called from the executor once done. The callback
+ * must not wait for other EC transactions.
+ */
+u32 uniwill_ec_submit(struct uniwill_ec_txn *txn)
+{
+	unsigned long flags;
+
+	if (txn->prio >= UW_EC_PRIO_COUNT || txn->count == 0)
+		return -EINVAL;
+
+	spin_lock_irqsave(&uniwill_ec_queue_lock, flags);
+	list_add_tail(&txn->list, &uniwill_ec_queues[txn->prio]);
+	spin_unlock_irqrestore(&uniwill_ec_queue_lock, flags);
+
+	queue_work(system_highpri_wq, &uniwill_ec_executor);
+
+	return 0;
+}
+EXPORT_SYMBOL(uniwill_ec_submit);
+
+static void uniwill_ec_complete_sync(struct uniwill_ec_txn *txn)
+{
+	complete((struct completion *) txn->context);
+}
+
+/**
+ * Queue a transaction and wait for it to finish
+ */
+static u32 uniwill_ec_transact(bool write, const u16 *addresses, u8 *data, u32 count, u8 prio)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct uniwill_ec_txn txn = {
+		.prio = prio,
+		.write = write,
+		.addr = addresses,
+		.data = data,
+		.count = count,
+		.complete = uniwill_ec_complete_sync,
+		.context = &done,
+	};
+	u32 status;
+
+	status = uniwill_ec_submit(&txn);
+	if (status != 0)
+		return status;
+
+	wait_for_completion(&done);
+
+	return txn.status;
+}
+
+struct uniwill_ec_async_write_t {
+	struct uniwill_ec_txn txn;
+	u16 addr;
+	u8 data;
+};
+
+static void uniwill_ec_complete_async_write(struct uniwill_ec_txn *txn)
+{
+	kfree(container_of(txn, struct uniwill_ec_async_write_t, txn));
+}
+
+/**
+ * Fire and forget EC RAM write, can be called from atomic context
+ */
+u32 uniwill_write_ec_ram_async(u16 address, u8 data, u8 prio)
+{
+	struct uniwill_ec_async_write_t *req;
+	u32 status;
+
+	req = kzalloc(sizeof(*req), GFP_ATOMIC);
+	if (!req)
+		return -ENOMEM;
+
+	req->addr = address;
+	req->data = data;
+	req->txn.prio = prio;
+	req->txn.write = true;
+	req->txn.addr = &req->addr;
+	req->txn.data = &req->data;
+	req->txn.count = 1;
+	req->txn.complete = uniwill_ec_complete_async_write;
+
+	status = uniwill_ec_submit(&req->txn);
+	if (status != 0)
+		kfree(req);
+
+	return status;
+}
+EXPORT_SYMBOL(uniwill_write_ec_ram_async);
+
+/**
+ * Read EC RAM, bypassing the cache
+ *
+ * A valid cache entry is left alone, like for any other read, only a
+ * missing entry is filled (or a failed read invalidates it).
+ */
+u32 uniwill_read_ec_ram_nocache(u16 address, u8 *data)
+{
+	return uniwill_ec_transact(false, &address, data, 1, UW_EC_PRIO_TELEMETRY);
+}
+EXPORT_SYMBOL(uniwill_read_ec_ram_nocache);
+
+u32 uniwill_read_ec_ram_prio(u16 address, u8 *data, u8 prio)
+{
+	if (uniwill_ec_cache_get(address, data))
+		return 0;
+
+	return uniwill_ec_transact(false, &address, data, 1, prio);
+}
+EXPORT_SYMBOL(uniwill_read_ec_ram_prio);
+
+u32 uniwill_write_ec_ram_prio(u16 address, u8 data, u8 prio)
+{
+	return uniwill_ec_transact(true, &address, &data, 1, prio);
+}
+EXPORT_SYMBOL(uniwill_write_ec_ram_prio);
+
+u32 uniwill_read_ec_ram(u16 address, u8 *data)
+{
+	return uniwill_read_ec_ram_prio(address, data, UW_EC_PRIO_TELEMETRY);
+}
+EXPORT_SYMBOL(uniwill_read_ec_ram);
+
+u32 uniwill_write_ec_ram(u16 address, u8 data)
+{
+	return uniwill_write_ec_ram_prio(address, data, UW_EC_PRIO_TELEMETRY);
+}
 EXPORT_SYMBOL(uniwill_write_ec_ram);
 
+// Longest address list for uniwill_read_ec_ram_multi_prio()
+#define UW_EC_MULTI_MAX		64
+
+/**
+ * Read a list of addresses, all cache misses are read in one executor
+ * job so that they are sampled within a single hold of the EC lock
+ */
+u32 uniwill_read_ec_ram_multi_prio(const u16 *addresses, u8 *data, u32 count, u8 prio)
+{
+	u16 miss_addr[UW_EC_MULTI_MAX];
+	u8 miss_data[UW_EC_MULTI_MAX];
+	u8 miss_index[UW_EC_MULTI_MAX];
+	u32 i, n_miss = 0, status = 0;
+
+	if (count > UW_EC_MULTI_MAX)
+		return -EINVAL;
+
+	for (i = 0; i < count; ++i) {
+		if (!uniwill_ec_cache_get(addresses[i], &data[i])) {
+			miss_addr[n_miss] = addresses[i];
+			miss_index[n_miss] = i;
+			n_miss += 1;
+		}
+	}
+
+	if (n_miss > 0) {
+		status = uniwill_ec_transact(false, miss_addr, miss_data, n_miss, prio);
+		for (i = 0; i < n_miss; ++i)
+			data[miss_index[i]] = miss_data[i];
+	}
+
+	return status;
+}
+EXPORT_SYMBOL(uniwill_read_ec_ram_multi_prio);
+
+u32 uniwill_read_ec_ram_multi(const u16 *addresses, u8 *data, u32 count)
+{
+	return uniwill_read_ec_ram_multi_prio(addresses, data, count, UW_EC_PRIO_TELEMETRY);
+}
+EXPORT_SYMBOL(uniwill_read_ec_ram_multi);
+
+u32 uniwill_write_ec_ram_multi_prio(const u16 *addresses, const u8 *data, u32 count, u8 prio)
+{
+	// Data is not modified for writes
+	return uniwill_ec_transact(true, addresses, (u8 *) data, count, prio);
+}
+EXPORT_SYMBOL(uniwill_write_ec_ram_multi_prio);
+
+u32 uniwill_write_ec_ram_multi(const u16 *addresses, const u8 *data, u32 count)
+{
+	return uniwill_write_ec_ram_multi_prio(addresses, data, count, UW_EC_PRIO_TELEMETRY);
+}
+EXPORT_SYMBOL(uniwill_write_ec_ram_multi);
+
+/**
+ * Set a cached register without hardware access, the value is written
+ * on the next uniwill_sync_ec_ram(). Writes that don't change the known
+ * value are dropped. Volatile registers are written immediately.
+ */
+u32 uniwill_write_ec_ram_deferred(u16 address, u8 data)
+{
+	struct uniwill_ec_reg_t *reg = uniwill_ec_reg_cached(address);
+	unsigned long flags;
+
+	if (reg == NULL)
+		return uniwill_write_ec_ram(address, data);
+
+	spin_lock_irqsave(&uniwill_ec_cache_lock, flags);
+	if (!reg->valid || reg->value != data || reg->dirty) {
+		reg->value = data;
+		reg->valid = true;
+		reg->dirty = true;
+	}
+	spin_unlock_irqrestore(&uniwill_ec_cache_lock, flags);
+
+	return 0;
+}
+EXPORT_SYMBOL(uniwill_write_ec_ram_deferred);
+
+/**
+ * Write all pending deferred values to the EC in one transaction
+ */
+u32 uniwill_sync_ec_ram(u8 prio)
+{
+	u16 addresses[ARRAY_SIZE(uniwill_ec_regs)];
+	u8 data[ARRAY_SIZE(uniwill_ec_regs)];
+	unsigned long flags;
+	u32 i, count = 0;
+
+	spin_lock_irqsave(&uniwill_ec_cache_lock, flags);
+	for (i = 0; i < ARRAY_SIZE(uniwill_ec_regs); ++i) {
+		if (uniwill_ec_regs[i].dirty) {
+			addresses[count] = uniwill_ec_regs[i].addr;
+			data[count] = uniwill_ec_regs[i].value;
+			count += 1;
+		}
+	}
+	spin_unlock_irqrestore(&uniwill_ec_cache_lock, flags);
+
+	if (count == 0)
+		return 0;
+
+	return uniwill_ec_transact(true, addresses, data, count, prio);
+}
+EXPORT_SYMBOL(uniwill_sync_ec_ram);
+
 static DEFINE_MUTEX(uniwill_interface_modification_lock);
 
 u32 uniwill_add_interface(struct uniwill_interface_t *interface)
@@ -138,6 +613,7 @@ u32 uniwill_add_interface(struct uniwill_interface_t *interface)
 		return -EINVAL;
 	}
 	interface->event_callb = uniwill_event_callb;
+	uniwill_invalidate_ec_ram_cache();
 
 	mutex_unlock(&uniwill_interface_modification_lock);
 
@@ -157,6 +633,8 @@ u32 uniwill_remove_interface(struct uniwill_interface_t *interface)
 		tuxedo_keyboard_remove_driver(&uniwill_keyboard_driver);
 
 		uniwill_interfaces.wmi = NULL;
+		// Make sure no queued EC transaction still uses the interface
+		flush_work(&uniwill_ec_executor);
 	} else {
 		mutex_unlock(&uniwill_interface_modification_lock);
 		return -EINVAL;
@@ -230,7 +708,7 @@ static u8 uniwill_read_kbd_bl_enabled(void)
 	u8 backlight_data;
 	u8 enabled = 0xff;
 
-	uniwill_read_ec_ram(0x078c, &backlight_data);
+	uniwill_read_ec_ram(UW_EC_RAM_KBD_BL_STATUS, &backlight_data);
 	enabled = (backlight_data >> 1) & 0x01;
 	enabled = !enabled;
 
@@ -242,10 +720,10 @@ static void uniwill_write_kbd_bl_enable(u8 enable)
 	u8 backlight_data;
 	enable = enable & 0x01;
 
-	uniwill_read_ec_ram(0x078c, &backlight_data);
+	uniwill_read_ec_ram(UW_EC_RAM_KBD_BL_STATUS, &backlight_data);
 	backlight_data = backlight_data & ~(1 << 1);
 	backlight_data |= (!enable << 1);
-	uniwill_write_ec_ram(0x078c, backlight_data);
+	uniwill_write_ec_ram(UW_EC_RAM_KBD_BL_STATUS, backlight_data);
 }
 
 /*static u32 uniwill_read_kbd_bl_br_state(u8 *brightness_state)
@@ -253,38 +731,43 @@ static void uniwill_write_kbd_bl_enable(u8 enable)
 	u8 backlight_data;
 	u32 result;
 
-	uniwill_read_ec_ram(0x078c, &backlight_data);
+	uniwill_read_ec_ram(UW_EC_RAM_KBD_BL_STATUS, &backlight_data);
 	*brightness_state = (backlight_data & 0xf0) >> 4;
 	result = 0;
 
 	return result;
 }*/
 
+/**
+ * Read the current keyboard colors from the EC, bypassing the cache
+ * since the EC changes them during the boot animation
+ */
 static u32 uniwill_read_kbd_bl_rgb(u8 *red, u8 *green, u8 *blue)
 {
 	u32 result;
 
-	uniwill_read_ec_ram(0x1803, red);
-	uniwill_read_ec_ram(0x1805, green);
-	uniwill_read_ec_ram(0x1808, blue);
+	uniwill_read_ec_ram_nocache(UW_EC_RAM_KBD_BL_RGB_RED, red);
+	uniwill_read_ec_ram_nocache(UW_EC_RAM_KBD_BL_RGB_GREEN, green);
+	uniwill_read_ec_ram_nocache(UW_EC_RAM_KBD_BL_RGB_BLUE, blue);
 
 	result = 0;
 
 	return result;
 }
 
-static void uniwill_write_kbd_bl_rgb(u8 red, u8 green, u8 blue)
+static void uniwill_write_kbd_bl_rgb(u8 red, u8 green, u8 blue, u8 prio)
 {
 	if (red > 0xc8) red = 0xc8;
 	if (green > 0xc8) green = 0xc8;
 	if (blue > 0xc8) blue = 0xc8;
-	uniwill_write_ec_ram(0x1803, red);
-	uniwill_write_ec_ram(0x1805, green);
-	uniwill_write_ec_ram(0x1808, blue);
+	uniwill_write_ec_ram_deferred(UW_EC_RAM_KBD_BL_RGB_RED, red);
+	uniwill_write_ec_ram_deferred(UW_EC_RAM_KBD_BL_RGB_GREEN, green);
+	uniwill_write_ec_ram_deferred(UW_EC_RAM_KBD_BL_RGB_BLUE, blue);
+	uniwill_sync_ec_ram(prio);
 	TUXEDO_DEBUG("Wrote kbd color [%0#4x, %0#4x, %0#4x]\n", red, green, blue);
 }
 
-static void uniwill_write_kbd_bl_state(void) {
+static void uniwill_write_kbd_bl_state(u8 prio) {
 	// Get single colors from state
 	u32 color_red = ((kbd_led_state_uw.color >> 0x10) & 0xff);
 	u32 color_green = (kbd_led_state_uw.color >> 0x08) & 0xff;
@@ -302,16 +785,20 @@ static void uniwill_write_kbd_bl_state(void) {
 	color_green = (color_green * brightness_percentage) / 100;
 	color_blue = (color_blue * brightness_percentage) / 100;
 
-	uniwill_write_kbd_bl_rgb(color_red, color_green, color_blue);
+	uniwill_write_kbd_bl_rgb(color_red, color_green, color_blue, prio);
 }
 
 static void uniwill_write_kbd_bl_reset(void)
 {
-	uniwill_write_ec_ram(0x078c, 0x10);
+	uniwill_write_ec_ram(UW_EC_RAM_KBD_BL_STATUS, 0x10);
+	// Colors are reset by the EC
+	uniwill_invalidate_ec_ram_cache();
 }
 
 void uniwill_event_callb(u32 code)
 {
+	tuxedo_event_notify(TUXEDO_EVENT_SOURCE_UNIWILL, code);
+
 	if (uniwill_keyboard_driver.input_device != NULL)
 		if (!sparse_keymap_report_known_event(uniwill_keyboard_driver.input_device, code, 1, true)) {
 			TUXEDO_DEBUG("Unknown code - %d (%0#6x)\n", code, code);
@@ -334,27 +821,29 @@ void uniwill_event_callb(u32 code)
 		switch (code) {
 		case UNIWILL_OSD_KB_LED_LEVEL0:
 			kbd_led_state_uw.brightness = 0x00;
-			uniwill_write_kbd_bl_state();
+			uniwill_write_kbd_bl_state(UW_EC_PRIO_INPUT);
 			break;
 		case UNIWILL_OSD_KB_LED_LEVEL1:
 			kbd_led_state_uw.brightness = 0x20;
-			uniwill_write_kbd_bl_state();
+			uniwill_write_kbd_bl_state(UW_EC_PRIO_INPUT);
 			break;
 		case UNIWILL_OSD_KB_LED_LEVEL2:
 			kbd_led_state_uw.brightness = 0x50;
-			uniwill_write_kbd_bl_state();
+			uniwill_write_kbd_bl_state(UW_EC_PRIO_INPUT);
 			break;
 		case UNIWILL_OSD_KB_LED_LEVEL3:
 			kbd_led_state_uw.brightness = 0x80;
-			uniwill_write_kbd_bl_state();
+			uniwill_write_kbd_bl_state(UW_EC_PRIO_INPUT);
 			break;
 		case UNIWILL_OSD_KB_LED_LEVEL4:
 			kbd_led_state_uw.brightness = 0xc8;
-			uniwill_write_kbd_bl_state();
+			uniwill_write_kbd_bl_state(UW_EC_PRIO_INPUT);
 			break;
 		// Also refresh keyboard state on cable switch event
 		case UNIWILL_OSD_DC_ADAPTER_CHANGE:
-			uniwill_write_kbd_bl_state();
+			// Colors can be changed by the EC, don't trust the cache
+			uniwill_invalidate_ec_ram_cache();
+			uniwill_write_kbd_bl_state(UW_EC_PRIO_INPUT);
 			break;
 		}
 	}
@@ -375,7 +864,7 @@ static ssize_t uw_brightness_store(struct device *child,
 	if (err) return err;
 	if (brightness_input > UNIWILL_BRIGHTNESS_MAX) return -EINVAL;
 	kbd_led_state_uw.brightness = (u8)brightness_input;
-	uniwill_write_kbd_bl_state();
+	uniwill_write_kbd_bl_state(UW_EC_PRIO_LIGHTING);
 	return size;
 }
 
@@ -406,7 +895,7 @@ static ssize_t uw_color_string_store(struct device *child,
 
 	if (color_value > 0xffffff) return -EINVAL;
 	kbd_led_state_uw.color = color_value;
-	uniwill_write_kbd_bl_state();
+	uniwill_write_kbd_bl_state(UW_EC_PRIO_LIGHTING);
 	return size;
 }
 
@@ -431,6 +920,121 @@ static struct attribute_group uw_kbd_bl_color_attr_group = {
 	.attrs = uw_kbd_bl_color_attrs
 };
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+/*
+ * Multicolor LED class device for the single color RGB backlight
+ *
+ * brightness_set may run in atomic context, the EC writes are made
+ * from a work item with the newest requested state. Brightness is
+ * exposed as 0-255 like the intensities and scaled to the EC range.
+ */
+#define UW_MC_BRIGHTNESS_MAX	255
+
+static struct mc_subled uw_mc_subleds[3];
+static struct led_classdev_mc uw_mc_cdev;
+static bool uw_mc_registered;
+// Intensities at the last brightness_set, to tell color changes apart
+static u32 uw_mc_color;
+
+static struct {
+	bool pending;
+	bool color_changed;
+	u32 color;
+	u32 brightness;
+} uw_mc_request;
+
+static DEFINE_SPINLOCK(uw_mc_lock);
+
+static void uw_mc_work_func(struct work_struct *work)
+{
+	u32 color, brightness;
+	bool pending, color_changed;
+	unsigned long flags;
+
+	spin_lock_irqsave(&uw_mc_lock, flags);
+	pending = uw_mc_request.pending;
+	color_changed = uw_mc_request.color_changed;
+	color = uw_mc_request.color;
+	brightness = uw_mc_request.brightness;
+	uw_mc_request.pending = false;
+	uw_mc_request.color_changed = false;
+	spin_unlock_irqrestore(&uw_mc_lock, flags);
+
+	if (!pending)
+		return;
+
+	if (color_changed)
+		kbd_led_state_uw.color = color;
+	kbd_led_state_uw.brightness = brightness * UNIWILL_BRIGHTNESS_MAX / UW_MC_BRIGHTNESS_MAX;
+	uniwill_write_kbd_bl_state(UW_EC_PRIO_LIGHTING);
+}
+
+static DECLARE_WORK(uw_mc_work, uw_mc_work_func);
+
+static void uw_mc_brightness_set(struct led_classdev *led_cdev, enum led_brightness brightness)
+{
+	unsigned long flags;
+	u32 color;
+
+	spin_lock_irqsave(&uw_mc_lock, flags);
+	color = (uw_mc_subleds[0].intensity << 0x10)
+	      | (uw_mc_subleds[1].intensity << 0x08)
+	      | uw_mc_subleds[2].intensity;
+	// A plain brightness write keeps a color set through uw_kbd_bl_color
+	if (color != uw_mc_color) {
+		uw_mc_request.color = color;
+		uw_mc_request.color_changed = true;
+		uw_mc_color = color;
+	}
+	uw_mc_request.brightness = brightness;
+	uw_mc_request.pending = true;
+	spin_unlock_irqrestore(&uw_mc_lock, flags);
+
+	schedule_work(&uw_mc_work);
+}
+
+static enum led_brightness uw_mc_brightness_get(struct led_classdev *led_cdev)
+{
+	return kbd_led_state_uw.brightness * UW_MC_BRIGHTNESS_MAX / UNIWILL_BRIGHTNESS_MAX;
+}
+
+static void uw_mc_led_init(struct platform_device *dev)
+{
+	const u32 color_ids[] = { LED_COLOR_ID_RED, LED_COLOR_ID_GREEN, LED_COLOR_ID_BLUE };
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(uw_mc_subleds); ++i) {
+		uw_mc_subleds[i].color_index = color_ids[i];
+		uw_mc_subleds[i].intensity = (kbd_led_state_uw.color >> (0x10 - 0x08 * i)) & 0xff;
+	}
+	uw_mc_color = kbd_led_state_uw.color & 0xffffff;
+	uw_mc_cdev.subled_info = uw_mc_subleds;
+	uw_mc_cdev.num_colors = ARRAY_SIZE(uw_mc_subleds);
+	uw_mc_cdev.led_cdev.name = "rgb:kbd_backlight";
+	uw_mc_cdev.led_cdev.max_brightness = UW_MC_BRIGHTNESS_MAX;
+	uw_mc_cdev.led_cdev.brightness = uw_mc_brightness_get(&uw_mc_cdev.led_cdev);
+	// Unregistering must not switch the backlight off
+	uw_mc_cdev.led_cdev.flags |= LED_RETAIN_AT_SHUTDOWN;
+	uw_mc_cdev.led_cdev.brightness_set = uw_mc_brightness_set;
+	uw_mc_cdev.led_cdev.brightness_get = uw_mc_brightness_get;
+
+	uw_mc_registered = led_classdev_multicolor_register(&dev->dev, &uw_mc_cdev) == 0;
+	if (!uw_mc_registered)
+		TUXEDO_ERROR("Failed to register keyboard backlight LED device\n");
+}
+
+static void uw_mc_led_remove(void)
+{
+	if (uw_mc_registered)
+		led_classdev_multicolor_unregister(&uw_mc_cdev);
+	uw_mc_registered = false;
+	cancel_work_sync(&uw_mc_work);
+}
+#else
+static void uw_mc_led_init(struct platform_device *dev) { }
+static void uw_mc_led_remove(void) { }
+#endif
+
 static void uw_kbd_bl_init_set(void)
 {
 	if (uniwill_kbd_bl_type_rgb_single_color) {
@@ -443,7 +1047,7 @@ static void uw_kbd_bl_init_set(void)
 		// uniwill_write_kbd_bl_enable(0);
 
 		// Update keyboard backlight according to the current state
-		uniwill_write_kbd_bl_state();
+		uniwill_write_kbd_bl_state(UW_EC_PRIO_LIGHTING);
 	}
 
 	// Enable keyboard backlight
@@ -544,6 +1148,8 @@ static int uw_kbd_bl_init(struct platform_device *dev)
 		status = sysfs_create_group(&dev->dev.kobj, &uw_kbd_bl_color_attr_group);
 		if (status) TUXEDO_ERROR("Failed to create sysfs group\n");
 
+		uw_mc_led_init(dev);
+
 		// Start periodic checking of animation, set and enable bl when done
 		timer_setup(&uw_kbd_bl_init_timer, uw_kbd_bl_init_ready_check, 0);
 		mod_timer(&uw_kbd_bl_init_timer, jiffies + msecs_to_jiffies(uw_kbd_bl_init_check_interval_ms));
@@ -565,40 +1171,40 @@ static int uw_kbd_bl_init(struct platform_device *dev)
 static void uniwill_write_lightbar_rgb(u8 red, u8 green, u8 blue)
 {
 	if (red <= UNIWILL_LIGHTBAR_LED_MAX_BRIGHTNESS) {
-		uniwill_write_ec_ram(0x0749, red);
+		uniwill_write_ec_ram_deferred(UW_EC_RAM_LIGHTBAR_RED, red);
 	}
 	if (green <= UNIWILL_LIGHTBAR_LED_MAX_BRIGHTNESS) {
-		uniwill_write_ec_ram(0x074a, green);
+		uniwill_write_ec_ram_deferred(UW_EC_RAM_LIGHTBAR_GREEN, green);
 	}
 	if (blue <= UNIWILL_LIGHTBAR_LED_MAX_BRIGHTNESS) {
-		uniwill_write_ec_ram(0x074b, blue);
+		uniwill_write_ec_ram_deferred(UW_EC_RAM_LIGHTBAR_BLUE, blue);
 	}
 }
 
 static void uniwill_read_lightbar_rgb(u8 *red, u8 *green, u8 *blue)
 {
-	uniwill_read_ec_ram(0x0749, red);
-	uniwill_read_ec_ram(0x074a, green);
-	uniwill_read_ec_ram(0x074b, blue);
+	uniwill_read_ec_ram(UW_EC_RAM_LIGHTBAR_RED, red);
+	uniwill_read_ec_ram(UW_EC_RAM_LIGHTBAR_GREEN, green);
+	uniwill_read_ec_ram(UW_EC_RAM_LIGHTBAR_BLUE, blue);
 }
 
 static void uniwill_write_lightbar_animation(bool animation_status)
 {
 	u8 value;
 
-	uniwill_read_ec_ram(0x0748, &value);
+	uniwill_read_ec_ram(UW_EC_RAM_LIGHTBAR_ANIMATION, &value);
 	if (animation_status) {
 		value |= 0x80;
 	} else {
 		value &= ~0x80;
 	}
-	uniwill_write_ec_ram(0x0748, value);
+	uniwill_write_ec_ram_deferred(UW_EC_RAM_LIGHTBAR_ANIMATION, value);
 }
 
 static void uniwill_read_lightbar_animation(bool *animation_status)
 {
 	u8 lightbar_animation_data;
-	uniwill_read_ec_ram(0x0748, &lightbar_animation_data);
+	uniwill_read_ec_ram(UW_EC_RAM_LIGHTBAR_ANIMATION, &lightbar_animation_data);
 	*animation_status = (lightbar_animation_data & 0x80) > 0;
 }
 
@@ -628,6 +1234,7 @@ static int lightbar_set_blocking(struct led_classdev *led_cdev, enum led_brightn
 			uniwill_write_lightbar_animation(false);
 		}
 	}
+	uniwill_sync_ec_ram(UW_EC_PRIO_LIGHTING);
 	return 0;
 }
 
@@ -740,20 +1347,21 @@ static int uniwill_keyboard_probe(struct platform_device *dev)
 	// FIXME Hard set balanced profile until we have implemented a way to
 	// switch it while tuxedo_io is loaded
 	// uw_ec_write_addr(0x51, 0x07, 0x00, 0x00, &reg_write_return);
-	uniwill_write_ec_ram(0x0751, 0x00);
+	uniwill_write_ec_ram(UW_EC_RAM_MODE, 0x00);
 
 	// Set manual-mode fan-curve in 0x0743 - 0x0747
 	// Some kind of default fan-curve is stored in 0x0786 - 0x078a: Using it to initialize manual-mode fan-curve
-	for (i = 0; i < 5; ++i) {
-		uniwill_read_ec_ram(0x0786 + i, &data);
-		uniwill_write_ec_ram(0x0743 + i, data);
+	for (i = 0; i < UW_EC_RAM_FAN_CURVE_LENGTH; ++i) {
+		uniwill_read_ec_ram(UW_EC_RAM_FAN_CURVE_DEFAULT + i, &data);
+		uniwill_write_ec_ram_deferred(UW_EC_RAM_FAN_CURVE + i, data);
 	}
 
 	// Enable manual mode
-	uniwill_write_ec_ram(0x0741, 0x01);
+	uniwill_write_ec_ram_deferred(UW_EC_RAM_MANUAL_MODE, 0x01);
+	uniwill_sync_ec_ram(UW_EC_PRIO_FAN);
 
 	// Zero second fan temp for detection
-	uniwill_write_ec_ram(0x044f, 0x00);
+	uniwill_write_ec_ram(UW_EC_RAM_FAN1_TEMP, 0x00);
 
 	status = register_keyboard_notifier(&keyboard_notifier_block);
 
@@ -769,6 +1377,7 @@ static int uniwill_keyboard_remove(struct platform_device *dev)
 {
 
 	if (uniwill_kbd_bl_type_rgb_single_color) {
+		uw_mc_led_remove();
 		sysfs_remove_group(&dev->dev.kobj, &uw_kbd_bl_color_attr_group);
 	}
 
@@ -785,7 +1394,7 @@ static int uniwill_keyboard_remove(struct platform_device *dev)
 		uw_lightbar_remove(dev);
 
 	// Disable manual mode
-	uniwill_write_ec_ram(0x0741, 0x00);
+	uniwill_write_ec_ram(UW_EC_RAM_MANUAL_MODE, 0x00);
 
 	return 0;
 }
@@ -798,10 +1407,13 @@ static int uniwill_keyboard_suspend(struct platform_device *dev, pm_message_t st
 
 static int uniwill_keyboard_resume(struct platform_device *dev)
 {
+	// EC state is not guaranteed to survive suspend
+	uniwill_invalidate_ec_ram_cache();
+
 	if (uniwill_kbd_bl_type_rgb_single_color) {
 		uniwill_write_kbd_bl_reset();
 		msleep(100);
-		uniwill_write_kbd_bl_state();
+		uniwill_write_kbd_bl_state(UW_EC_PRIO_LIGHTING);
 	}
 	uniwill_write_kbd_bl_enable(1);
 	return 0;
@@ -22,7 +22,10 @@
 #include <linux/wmi.h>
 #include <linux/version.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include "uniwill_interfaces.h"
+#include "tuxedo_trace.h"
 
 #define UNIWILL_EC_REG_LDAT	0x8a
 #define UNIWILL_EC_REG_HDAT	0x8b
@@ -36,32 +39,178 @@
 #define UNIWILL_EC_BIT_CFLG	3
 #define UNIWILL_EC_BIT_DRDY	7
 
+// Timeout for the direct handshake in (originally 1ms) wait cycles
 #define UW_EC_WAIT_CYCLES	0x50
 
+// Bounds for the adaptive ready flag polling
+#define UW_EC_WAIT_SPIN_MIN_NS	10000
+#define UW_EC_WAIT_SPIN_MAX_NS	200000
+#define UW_EC_WAIT_SLEEP_MIN_US	20
+#define UW_EC_WAIT_SLEEP_MAX_US	1000
+
+// Result marker of a timed out EC access, on both transports
+#define UW_EC_TIMEOUT_MARKER	0xfefefefe
+
+// Transport auto selection: number of samples taken per transport at probe,
+// access interval for sampling the inactive transport and tolerated rolling
+// error rate (per mille)
+#define UW_EC_AUTO_BENCH_COUNT	8
+#define UW_EC_AUTO_REPROBE	64
+#define UW_EC_AUTO_ERR_PM_MAX	50
+
 static bool uniwill_ec_direct = true;
+static bool uniwill_ec_auto = false;
+
+/*
+ * Register access used by the direct EC handshake
+ */
+struct uniwill_ec_port_ops {
+	const char *name;
+	int (*read)(u8 reg, u8 *val);
+	int (*write)(u8 reg, u8 val);
+};
+
+static const struct uniwill_ec_port_ops uw_ec_port_acpi = {
+	.name = "acpi",
+	.read = ec_read,
+	.write = ec_write,
+};
+
+#include "uniwill_ec_sim.h"
+
+// Size of the WMI EC call argument and of its result buffer
+#define UW_WMI_EC_ARG_SIZE	40
+
+/*
+ * Preallocated WMI EC call buffers, protected by uniwill_ec_lock. ACPICA
+ * stores the result object and its data in out if they fit.
+ */
+static struct {
+	u8 arg[UW_WMI_EC_ARG_SIZE];
+	union {
+		union acpi_object obj;
+		u8 bytes[sizeof(union acpi_object) + 2 * UW_WMI_EC_ARG_SIZE];
+	} out;
+} uw_wmi_ec_call;
+
+static const struct uniwill_ec_port_ops *uw_ec_port = &uw_ec_port_acpi;
 
 DEFINE_MUTEX(uniwill_ec_lock);
 
-static u32 uw_wmi_ec_evaluate(u8 addr_low, u8 addr_high, u8 data_low, u8 data_high, u8 read_flag, u32 *return_buffer)
+// Time waited for uniwill_ec_lock, reported by the first access of the hold
+static u64 uw_ec_lock_wait_ns;
+
+static void uw_ec_lock(void)
+{
+	ktime_t start = ktime_get();
+	mutex_lock(&uniwill_ec_lock);
+	uw_ec_lock_wait_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+static void uw_ec_unlock(void)
+{
+	mutex_unlock(&uniwill_ec_lock);
+}
+
+/**
+ * Lock wait to report for the current access, caller has to hold uniwill_ec_lock
+ */
+static u64 uw_ec_take_lock_wait(void)
+{
+	u64 wait_ns = uw_ec_lock_wait_ns;
+	uw_ec_lock_wait_ns = 0;
+	return wait_ns;
+}
+
+/*
+ * Learned timing of the direct handshake, protected by uniwill_ec_lock
+ *
+ * The time until the EC signals DRDY is tracked as a moving average
+ * (weight 1/8). Polling first spins for twice the average, then
+ * continues with sleeps of a quarter of the average.
+ */
+static struct uw_ec_wait_t {
+	u32 avg_ns;
+	u32 max_ns;
+	u32 spin_ns;
+	u32 sleep_us;
+	u32 timeouts;
+} uw_ec_wait = {
+	.avg_ns = 1000000,
+	.max_ns = 0,
+	.spin_ns = UW_EC_WAIT_SPIN_MIN_NS,
+	.sleep_us = UW_EC_WAIT_SLEEP_MAX_US,
+	.timeouts = 0,
+};
+
+static void uw_ec_wait_learn(u32 elapsed_ns)
+{
+	s64 diff = (s64) elapsed_ns - uw_ec_wait.avg_ns;
+
+	uw_ec_wait.avg_ns += div_s64(diff, 8);
+	if (elapsed_ns > uw_ec_wait.max_ns)
+		uw_ec_wait.max_ns = elapsed_ns;
+
+	uw_ec_wait.spin_ns = clamp_t(u32, 2 * uw_ec_wait.avg_ns,
+				     UW_EC_WAIT_SPIN_MIN_NS, UW_EC_WAIT_SPIN_MAX_NS);
+	uw_ec_wait.sleep_us = clamp_t(u32, uw_ec_wait.avg_ns / 4000,
+				      UW_EC_WAIT_SLEEP_MIN_US, UW_EC_WAIT_SLEEP_MAX_US);
+}
+
+/**
+ * Wait for the EC to set the DRDY flag, caller has to hold uniwill_ec_lock
+ *
+ * Returns true if the flag was set before the timeout
+ */
+static bool uw_ec_wait_ready(void)
+{
+	u8 tmp;
+	ktime_t start, now, spin_end, deadline;
+
+	start = ktime_get();
+	spin_end = ktime_add_ns(start, uw_ec_wait.spin_ns);
+	deadline = ktime_add_ms(start, UW_EC_WAIT_CYCLES);
+
+	uw_ec_port->read(UNIWILL_EC_REG_FLAGS, &tmp);
+	while ((tmp & (1 << UNIWILL_EC_BIT_DRDY)) == 0) {
+		now = ktime_get();
+		if (ktime_after(now, deadline)) {
+			uw_ec_wait.timeouts += 1;
+			return false;
+		}
+		if (ktime_before(now, spin_end))
+			cpu_relax();
+		else
+			usleep_range(uw_ec_wait.sleep_us, 2 * uw_ec_wait.sleep_us);
+		uw_ec_port->read(UNIWILL_EC_REG_FLAGS, &tmp);
+	}
+
+	uw_ec_wait_learn(ktime_to_ns(ktime_sub(ktime_get(), start)));
+
+	return true;
+}
+
+/**
+ * EC access through the WMI method, caller has to hold uniwill_ec_lock
+ */
+static u32 uw_wmi_ec_evaluate(u8 addr_low, u8 addr_high, u8 data_low, u8 data_high, u8 read_flag,
+			      u32 *return_buffer, size_t return_length)
 {
 	acpi_status status;
 	union acpi_object *out_acpi;
 	u32 e_result = 0;
+	u32 out_value = 0;
+	ktime_t start, hw_time;
 
-	// Kernel buffer for input argument
-	u32 *wmi_arg = (u32 *) kmalloc(sizeof(u32)*10, GFP_KERNEL);
-	// Byte reference to the input buffer
-	u8 *wmi_arg_bytes = (u8 *) wmi_arg;
+	u8 *wmi_arg_bytes = uw_wmi_ec_call.arg;
 
 	u8 wmi_instance = 0x00;
 	u32 wmi_method_id = 0x04;
-	struct acpi_buffer wmi_in = { (acpi_size) sizeof(wmi_arg), wmi_arg};
-	struct acpi_buffer wmi_out = { ACPI_ALLOCATE_BUFFER, NULL };
-
-	mutex_lock(&uniwill_ec_lock);
+	struct acpi_buffer wmi_in = { (acpi_size) sizeof(uw_wmi_ec_call.arg), wmi_arg_bytes };
+	struct acpi_buffer wmi_out = { (acpi_size) sizeof(uw_wmi_ec_call.out), &uw_wmi_ec_call.out };
 
 	// Zero input buffer
-	memset(wmi_arg, 0x00, 10 * sizeof(u32));
+	memset(wmi_arg_bytes, 0x00, sizeof(uw_wmi_ec_call.arg));
 
 	// Configure the input buffer
 	wmi_arg_bytes[0] = addr_low;
@@ -72,24 +221,32 @@ static u32 uw_wmi_ec_evaluate(u8 addr_low, u8 addr_high, u8 data_low, u8 data_hi
 	if (read_flag != 0) {
 		wmi_arg_bytes[5] = 0x01;
 	}
-	
-	status = wmi_evaluate_method(UNIWILL_WMI_MGMT_GUID_BC, wmi_instance, wmi_method_id, &wmi_in, &wmi_out);
-	out_acpi = (union acpi_object *) wmi_out.pointer;
 
-	if (out_acpi && out_acpi->type == ACPI_TYPE_BUFFER) {
-		memcpy(return_buffer, out_acpi->buffer.pointer, out_acpi->buffer.length);
+	start = ktime_get();
+	status = wmi_evaluate_method(UNIWILL_WMI_MGMT_GUID_BC, wmi_instance, wmi_method_id, &wmi_in, &wmi_out);
+	hw_time = ktime_sub(ktime_get(), start);
+	out_acpi = &uw_wmi_ec_call.out.obj;
+
+	memset(return_buffer, 0x00, return_length);
+	if (ACPI_SUCCESS(status) && out_acpi->type == ACPI_TYPE_BUFFER) {
+		memcpy(return_buffer, out_acpi->buffer.pointer,
+		       min_t(size_t, out_acpi->buffer.length, return_length));
+		out_value = return_buffer[0];
 	} /* else if (out_acpi && out_acpi->type == ACPI_TYPE_INTEGER) {
 		e_result = (u32) out_acpi->integer.value;
 	}*/
-	if (ACPI_FAILURE(status)) {
+	if (status == AE_BUFFER_OVERFLOW) {
+		// Not evaluated again, the method may already have written
+		pr_err("uniwill_wmi.h: Unexpected result size %llu\n", (u64) wmi_out.length);
+		e_result = -EIO;
+	} else if (ACPI_FAILURE(status)) {
 		pr_err("uniwill_wmi.h: Error evaluating method\n");
 		e_result = -EIO;
 	}
 
-	kfree(out_acpi);
-	kfree(wmi_arg);
-
-	mutex_unlock(&uniwill_ec_lock);
+	trace_uw_wmi_ec_evaluate((addr_high << 8) | addr_low, (data_high << 8) | data_low,
+				 read_flag != 0, out_value, (int)e_result,
+				 uw_ec_take_lock_wait(), ktime_to_ns(hw_time));
 
 	return e_result;
 }
@@ -99,9 +256,7 @@ static u32 uw_wmi_ec_evaluate(u8 addr_low, u8 addr_high, u8 data_low, u8 data_hi
  */
 static u32 uw_ec_read_addr_wmi(u8 addr_low, u8 addr_high, union uw_ec_read_return *output)
 {
-	u32 uw_data[10];
-	u32 ret = uw_wmi_ec_evaluate(addr_low, addr_high, 0x00, 0x00, 1, uw_data);
-	output->dword = uw_data[0];
+	u32 ret = uw_wmi_ec_evaluate(addr_low, addr_high, 0x00, 0x00, 1, &output->dword, sizeof(output->dword));
 	// pr_debug("addr: 0x%02x%02x value: %0#4x (high: %0#4x) result: %d\n", addr_high, addr_low, output->bytes.data_low, output->bytes.data_high, ret);
 	return ret;
 }
@@ -111,42 +266,33 @@ static u32 uw_ec_read_addr_wmi(u8 addr_low, u8 addr_high, union uw_ec_read_retur
  */
 static u32 uw_ec_write_addr_wmi(u8 addr_low, u8 addr_high, u8 data_low, u8 data_high, union uw_ec_write_return *output)
 {
-	u32 uw_data[10];
-	u32 ret = uw_wmi_ec_evaluate(addr_low, addr_high, data_low, data_high, 0, uw_data);
-	output->dword = uw_data[0];
-	return ret;
+	return uw_wmi_ec_evaluate(addr_low, addr_high, data_low, data_high, 0, &output->dword, sizeof(output->dword));
 }
 
 /**
- * Direct EC address read
+ * Direct EC address read, caller has to hold uniwill_ec_lock
  */
 static u32 uw_ec_read_addr_direct(u8 addr_low, u8 addr_high, union uw_ec_read_return *output)
 {
 	u32 result;
-	u8 tmp, count, flags;
-
-	mutex_lock(&uniwill_ec_lock);
+	u8 tmp, flags;
+	bool ready;
+	ktime_t start = ktime_get();
 
-	ec_write(UNIWILL_EC_REG_LDAT, addr_low);
-	ec_write(UNIWILL_EC_REG_HDAT, addr_high);
+	uw_ec_port->write(UNIWILL_EC_REG_LDAT, addr_low);
+	uw_ec_port->write(UNIWILL_EC_REG_HDAT, addr_high);
 
 	flags = (0 << UNIWILL_EC_BIT_DRDY) | (1 << UNIWILL_EC_BIT_RFLG);
-	ec_write(UNIWILL_EC_REG_FLAGS, flags);
+	uw_ec_port->write(UNIWILL_EC_REG_FLAGS, flags);
 
 	// Wait for ready flag
-	count = UW_EC_WAIT_CYCLES;
-	ec_read(UNIWILL_EC_REG_FLAGS, &tmp);
-	while (((tmp & (1 << UNIWILL_EC_BIT_DRDY)) == 0) && count != 0) {
-		msleep(1);
-		ec_read(UNIWILL_EC_REG_FLAGS, &tmp);
-		count -= 1;
-	}
+	ready = uw_ec_wait_ready();
 
-	if (count != 0) {
+	if (ready) {
 		output->dword = 0;
-		ec_read(UNIWILL_EC_REG_CMDL, &tmp);
+		uw_ec_port->read(UNIWILL_EC_REG_CMDL, &tmp);
 		output->bytes.data_low = tmp;
-		ec_read(UNIWILL_EC_REG_CMDH, &tmp);
+		uw_ec_port->read(UNIWILL_EC_REG_CMDH, &tmp);
 		output->bytes.data_high = tmp;
 		result = 0;
 	} else {
@@ -154,41 +300,40 @@ static u32 uw_ec_read_addr_direct(u8 addr_low, u8 addr_high, union uw_ec_read_re
 		result = -EIO;
 	}
 
-	ec_write(UNIWILL_EC_REG_FLAGS, 0x00);
+	uw_ec_port->write(UNIWILL_EC_REG_FLAGS, 0x00);
 
-	mutex_unlock(&uniwill_ec_lock);
+	trace_uw_ec_read_addr_direct((addr_high << 8) | addr_low, output->dword & 0xffff,
+				     (int)result, uw_ec_take_lock_wait(),
+				     ktime_to_ns(ktime_sub(ktime_get(), start)));
 
 	// pr_debug("addr: 0x%02x%02x value: %0#4x result: %d\n", addr_high, addr_low, output->bytes.data_low, result);
 
 	return result;
 }
 
+/**
+ * Direct EC address write, caller has to hold uniwill_ec_lock
+ */
 static u32 uw_ec_write_addr_direct(u8 addr_low, u8 addr_high, u8 data_low, u8 data_high, union uw_ec_write_return *output)
 {
 	u32 result = 0;
-	u8 tmp, count, flags;
+	u8 flags;
+	bool ready;
+	ktime_t start = ktime_get();
 
-	mutex_lock(&uniwill_ec_lock);
-
-	ec_write(UNIWILL_EC_REG_LDAT, addr_low);
-	ec_write(UNIWILL_EC_REG_HDAT, addr_high);
-	ec_write(UNIWILL_EC_REG_CMDL, data_low);
-	ec_write(UNIWILL_EC_REG_CMDH, data_high);
+	uw_ec_port->write(UNIWILL_EC_REG_LDAT, addr_low);
+	uw_ec_port->write(UNIWILL_EC_REG_HDAT, addr_high);
+	uw_ec_port->write(UNIWILL_EC_REG_CMDL, data_low);
+	uw_ec_port->write(UNIWILL_EC_REG_CMDH, data_high);
 
 	flags = (0 << UNIWILL_EC_BIT_DRDY) | (1 << UNIWILL_EC_BIT_WFLG);
-	ec_write(UNIWILL_EC_REG_FLAGS, flags);
+	uw_ec_port->write(UNIWILL_EC_REG_FLAGS, flags);
 
 	// Wait for ready flag
-	count = UW_EC_WAIT_CYCLES;
-	ec_read(UNIWILL_EC_REG_FLAGS, &tmp);
-	while (((tmp & (1 << UNIWILL_EC_BIT_DRDY)) == 0) && count != 0) {
-		msleep(1);
-		ec_read(UNIWILL_EC_REG_FLAGS, &tmp);
-		count -= 1;
-	}
+	ready = uw_ec_wait_ready();
 
 	// Replicate wmi output depending on success
-	if (count != 0) {
+	if (ready) {
 		output->bytes.addr_low = addr_low;
 		output->bytes.addr_high = addr_high;
 		output->bytes.data_low = data_low;
@@ -199,50 +344,331 @@ static u32 uw_ec_write_addr_direct(u8 addr_low, u8 addr_high, u8 data_low, u8 da
 		result = -EIO;
 	}
 
-	ec_write(UNIWILL_EC_REG_FLAGS, 0x00);
+	uw_ec_port->write(UNIWILL_EC_REG_FLAGS, 0x00);
 
-	mutex_unlock(&uniwill_ec_lock);
+	trace_uw_ec_write_addr_direct((addr_high << 8) | addr_low, (data_high << 8) | data_low,
+				      (int)result, uw_ec_take_lock_wait(),
+				      ktime_to_ns(ktime_sub(ktime_get(), start)));
 
 	return result;
 }
 
-u32 uw_wmi_read_ec_ram(u16 addr, u8 *data)
+enum uw_ec_transport {
+	UW_EC_TRANSPORT_DIRECT = 0,
+	UW_EC_TRANSPORT_WMI,
+	UW_EC_TRANSPORT_COUNT
+};
+
+static const char * const uw_ec_transport_names[] = { "direct", "wmi" };
+
+/*
+ * Rolling statistics per transport, protected by uniwill_ec_lock
+ *
+ * Latency and error rate are moving averages (weight 1/8), the error
+ * rate in per mille. Timeouts count as errors, including WMI calls
+ * that succeed but return the timeout marker.
+ */
+static struct uw_ec_transport_stats_t {
+	u32 avg_ns;
+	u32 err_pm;
+	u32 samples;
+	u32 errors;
+} uw_ec_transport_stats[UW_EC_TRANSPORT_COUNT];
+
+static u32 uw_ec_auto_accesses;
+
+static bool uw_ec_access_failed(u32 result, u32 output)
+{
+	return result != 0 || output == UW_EC_TIMEOUT_MARKER;
+}
+
+static void uw_ec_transport_account(enum uw_ec_transport transport, ktime_t start, bool failed)
+{
+	struct uw_ec_transport_stats_t *stats = &uw_ec_transport_stats[transport];
+	u32 elapsed_ns = (u32) min_t(s64, ktime_to_ns(ktime_sub(ktime_get(), start)), U32_MAX);
+	s32 err_sample = failed ? 1000 : 0;
+
+	if (stats->samples == 0)
+		stats->avg_ns = elapsed_ns;
+	else
+		stats->avg_ns += div_s64((s64) elapsed_ns - stats->avg_ns, 8);
+	stats->err_pm += (err_sample - (s32) stats->err_pm) / 8;
+
+	stats->samples++;
+	if (failed)
+		stats->errors++;
+}
+
+/**
+ * Faster of the reliable transports, or the least failing one if neither is reliable
+ */
+static enum uw_ec_transport uw_ec_transport_best(void)
+{
+	struct uw_ec_transport_stats_t *direct = &uw_ec_transport_stats[UW_EC_TRANSPORT_DIRECT];
+	struct uw_ec_transport_stats_t *wmi = &uw_ec_transport_stats[UW_EC_TRANSPORT_WMI];
+	bool direct_ok = direct->err_pm <= UW_EC_AUTO_ERR_PM_MAX;
+	bool wmi_ok = wmi->err_pm <= UW_EC_AUTO_ERR_PM_MAX;
+
+	// The simulated EC has no WMI counterpart
+	if (uniwill_ec_sim)
+		return UW_EC_TRANSPORT_DIRECT;
+
+	if (!uniwill_ec_auto)
+		return uniwill_ec_direct ? UW_EC_TRANSPORT_DIRECT : UW_EC_TRANSPORT_WMI;
+
+	if (direct_ok && wmi_ok)
+		return wmi->avg_ns < direct->avg_ns ? UW_EC_TRANSPORT_WMI : UW_EC_TRANSPORT_DIRECT;
+	if (direct_ok != wmi_ok)
+		return direct_ok ? UW_EC_TRANSPORT_DIRECT : UW_EC_TRANSPORT_WMI;
+
+	return wmi->err_pm < direct->err_pm ? UW_EC_TRANSPORT_WMI : UW_EC_TRANSPORT_DIRECT;
+}
+
+static enum uw_ec_transport uw_ec_transport_other(enum uw_ec_transport transport)
+{
+	return transport == UW_EC_TRANSPORT_DIRECT ? UW_EC_TRANSPORT_WMI : UW_EC_TRANSPORT_DIRECT;
+}
+
+/**
+ * Transport for the next access, caller has to hold uniwill_ec_lock
+ *
+ * In auto mode unmeasured transports are sampled first and the inactive
+ * one is sampled periodically to keep its statistics current.
+ */
+static enum uw_ec_transport uw_ec_transport_pick(void)
+{
+	enum uw_ec_transport best;
+	int i;
+
+	if (!uniwill_ec_auto || uniwill_ec_sim)
+		return uw_ec_transport_best();
+
+	for (i = 0; i < UW_EC_TRANSPORT_COUNT; ++i) {
+		if (uw_ec_transport_stats[i].samples == 0)
+			return (enum uw_ec_transport) i;
+	}
+
+	best = uw_ec_transport_best();
+	if (++uw_ec_auto_accesses % UW_EC_AUTO_REPROBE == 0)
+		return uw_ec_transport_other(best);
+
+	return best;
+}
+
+/**
+ * EC address read on the specified transport, caller has to hold uniwill_ec_lock
+ */
+static u32 uw_ec_read_addr(enum uw_ec_transport transport, u8 addr_low, u8 addr_high, union uw_ec_read_return *output)
+{
+	u32 result;
+	ktime_t start = ktime_get();
+
+	if (transport == UW_EC_TRANSPORT_DIRECT)
+		result = uw_ec_read_addr_direct(addr_low, addr_high, output);
+	else
+		result = uw_ec_read_addr_wmi(addr_low, addr_high, output);
+
+	uw_ec_transport_account(transport, start, uw_ec_access_failed(result, output->dword));
+
+	return result;
+}
+
+/**
+ * EC address write on the specified transport, caller has to hold uniwill_ec_lock
+ */
+static u32 uw_ec_write_addr(enum uw_ec_transport transport, u8 addr_low, u8 addr_high, u8 data_low, u8 data_high, union uw_ec_write_return *output)
+{
+	u32 result;
+	ktime_t start = ktime_get();
+
+	if (transport == UW_EC_TRANSPORT_DIRECT)
+		result = uw_ec_write_addr_direct(addr_low, addr_high, data_low, data_high, output);
+	else
+		result = uw_ec_write_addr_wmi(addr_low, addr_high, data_low, data_high, output);
+
+	uw_ec_transport_account(transport, start, uw_ec_access_failed(result, output->dword));
+
+	return result;
+}
+
+/**
+ * Read one EC RAM byte through the chosen method, caller has to hold uniwill_ec_lock
+ *
+ * In auto mode a failed access is repeated once on the other transport.
+ */
+static u32 __uw_wmi_read_ec_ram(u16 addr, u8 *data)
 {
 	u32 result;
 	u8 addr_low, addr_high;
 	union uw_ec_read_return output;
-
-	if (IS_ERR_OR_NULL(data))
-		return -EINVAL;
+	enum uw_ec_transport transport;
 
 	addr_low = addr & 0xff;
 	addr_high = (addr >> 8) & 0xff;
 
-	if (uniwill_ec_direct) {
-		result = uw_ec_read_addr_direct(addr_low, addr_high, &output);
-	} else {
-		result = uw_ec_read_addr_wmi(addr_low, addr_high, &output);
-	}
+	transport = uw_ec_transport_pick();
+	result = uw_ec_read_addr(transport, addr_low, addr_high, &output);
+	if (uniwill_ec_auto && !uniwill_ec_sim && uw_ec_access_failed(result, output.dword))
+		result = uw_ec_read_addr(uw_ec_transport_other(transport), addr_low, addr_high, &output);
 
 	*data = output.bytes.data_low;
 	return result;
 }
 
-u32 uw_wmi_write_ec_ram(u16 addr, u8 data)
+/**
+ * Write one EC RAM byte through the chosen method, caller has to hold uniwill_ec_lock
+ */
+static u32 __uw_wmi_write_ec_ram(u16 addr, u8 data)
 {
 	u32 result;
 	u8 addr_low, addr_high, data_low, data_high;
 	union uw_ec_write_return output;
+	enum uw_ec_transport transport;
 
 	addr_low = addr & 0xff;
 	addr_high = (addr >> 8) & 0xff;
 	data_low = data;
 	data_high = 0x00;
 
-	if (uniwill_ec_direct)
-		result = uw_ec_write_addr_direct(addr_low, addr_high, data_low, data_high, &output);
-	else
-		result = uw_ec_write_addr_wmi(addr_low, addr_high, data_low, data_high, &output);
+	transport = uw_ec_transport_pick();
+	result = uw_ec_write_addr(transport, addr_low, addr_high, data_low, data_high, &output);
+	if (uniwill_ec_auto && !uniwill_ec_sim && uw_ec_access_failed(result, output.dword))
+		result = uw_ec_write_addr(uw_ec_transport_other(transport), addr_low, addr_high, data_low, data_high, &output);
+
+	return result;
+}
+
+/**
+ * Sample both transports with reads of a side effect free register
+ */
+static void uw_ec_transport_benchmark(void)
+{
+	int i, t;
+	union uw_ec_read_return output;
+	struct uw_ec_transport_stats_t *stats;
+
+	uw_ec_lock();
+	for (t = 0; t < UW_EC_TRANSPORT_COUNT; ++t) {
+		for (i = 0; i < UW_EC_AUTO_BENCH_COUNT; ++i)
+			uw_ec_read_addr(t, UW_EC_RAM_MODE & 0xff, (UW_EC_RAM_MODE >> 8) & 0xff, &output);
+	}
+	uw_ec_unlock();
+
+	for (t = 0; t < UW_EC_TRANSPORT_COUNT; ++t) {
+		stats = &uw_ec_transport_stats[t];
+		pr_info("ec transport %s: avg %u ns, %u of %u failed\n",
+			uw_ec_transport_names[t], stats->avg_ns, stats->errors, stats->samples);
+	}
+	pr_info("ec transport selected: %s\n", uw_ec_transport_names[uw_ec_transport_best()]);
+}
+
+#ifdef DEBUG
+/*
+ * Throughput comparison, writing N runs N reads of the mode register on
+ * each transport and logs the achieved calls/s
+ */
+static int uw_ec_bench_set(const char *val, const struct kernel_param *kp)
+{
+	unsigned int count, i;
+	int t, err;
+	u64 start, ns;
+	union uw_ec_read_return output;
+
+	err = kstrtouint(val, 0, &count);
+	if (err)
+		return err;
+	if (uniwill_ec_sim)
+		return -EBUSY;
+
+	uw_ec_lock();
+	for (t = 0; t < UW_EC_TRANSPORT_COUNT; ++t) {
+		start = ktime_get_ns();
+		for (i = 0; i < count; ++i)
+			uw_ec_read_addr(t, UW_EC_RAM_MODE & 0xff, (UW_EC_RAM_MODE >> 8) & 0xff, &output);
+		ns = ktime_get_ns() - start;
+		pr_info("ec bench %s: %u reads in %llu ns, %llu calls/s\n",
+			uw_ec_transport_names[t], count, ns,
+			ns ? div64_u64((u64) count * NSEC_PER_SEC, ns) : 0);
+	}
+	uw_ec_unlock();
+
+	return 0;
+}
+
+static const struct kernel_param_ops param_ops_ec_bench = {
+	.set = uw_ec_bench_set,
+};
+
+module_param_cb(ec_bench, &param_ops_ec_bench, NULL, S_IWUSR);
+MODULE_PARM_DESC(ec_bench, "Run N EC reads on each transport and log calls/s");
+#endif
+
+u32 uw_wmi_read_ec_ram(u16 addr, u8 *data)
+{
+	u32 result;
+
+	if (IS_ERR_OR_NULL(data))
+		return -EINVAL;
+
+	uw_ec_lock();
+	result = __uw_wmi_read_ec_ram(addr, data);
+	uw_ec_unlock();
+
+	return result;
+}
+
+u32 uw_wmi_write_ec_ram(u16 addr, u8 data)
+{
+	u32 result;
+
+	uw_ec_lock();
+	result = __uw_wmi_write_ec_ram(addr, data);
+	uw_ec_unlock();
+
+	return result;
+}
+
+/**
+ * Read a list of EC RAM addresses within one hold of the EC lock
+ *
+ * All addresses are attempted, failed reads leave the (0xfe) timeout
+ * marker in the respective data byte. Returns the last error, if any.
+ */
+u32 uw_wmi_read_ec_ram_multi(const u16 *addr, u8 *data, u32 count)
+{
+	u32 i, status, result = 0;
+
+	if (IS_ERR_OR_NULL(addr) || IS_ERR_OR_NULL(data))
+		return -EINVAL;
+
+	uw_ec_lock();
+	for (i = 0; i < count; ++i) {
+		status = __uw_wmi_read_ec_ram(addr[i], &data[i]);
+		if (status != 0)
+			result = status;
+	}
+	uw_ec_unlock();
+
+	return result;
+}
+
+/**
+ * Write a list of EC RAM addresses within one hold of the EC lock
+ */
+u32 uw_wmi_write_ec_ram_multi(const u16 *addr, const u8 *data, u32 count)
+{
+	u32 i, status, result = 0;
+
+	if (IS_ERR_OR_NULL(addr) || IS_ERR_OR_NULL(data))
+		return -EINVAL;
+
+	uw_ec_lock();
+	for (i = 0; i < count; ++i) {
+		status = __uw_wmi_write_ec_ram(addr[i], data[i]);
+		if (status != 0)
+			result = status;
+	}
+	uw_ec_unlock();
 
 	return result;
 }
@@ -250,7 +676,9 @@ u32 uw_wmi_write_ec_ram(u16 addr, u8 data)
 struct uniwill_interface_t uniwill_wmi_interface = {
 	.string_id = UNIWILL_INTERFACE_WMI_STRID,
 	.read_ec_ram = uw_wmi_read_ec_ram,
-	.write_ec_ram = uw_wmi_write_ec_ram
+	.write_ec_ram = uw_wmi_write_ec_ram,
+	.read_ec_ram_multi = uw_wmi_read_ec_ram_multi,
+	.write_ec_ram_multi = uw_wmi_write_ec_ram_multi
 };
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5, 3, 0)
@@ -275,6 +703,9 @@ static int uniwill_wmi_probe(struct wmi_device *wdev, const void *dummy_context)
 		return -ENODEV;
 	}
 
+	if (uniwill_ec_auto)
+		uw_ec_transport_benchmark();
+
 	uniwill_add_interface(&uniwill_wmi_interface);
 
 	pr_info("interface initialized\n");
@@ -334,7 +765,28 @@ static struct wmi_driver uniwill_wmi_driver = {
 	.notify = uniwill_wmi_notify,
 };
 
-module_wmi_driver(uniwill_wmi_driver);
+static int __init uniwill_wmi_init(void)
+{
+	if (uniwill_ec_sim) {
+		uw_ec_port = &uw_ec_port_sim;
+		uniwill_add_interface(&uniwill_wmi_interface);
+		pr_info("simulated EC interface initialized\n");
+		return 0;
+	}
+
+	return wmi_driver_register(&uniwill_wmi_driver);
+}
+
+static void __exit uniwill_wmi_exit(void)
+{
+	if (uniwill_ec_sim)
+		uniwill_remove_interface(&uniwill_wmi_interface);
+	else
+		wmi_driver_unregister(&uniwill_wmi_driver);
+}
+
+module_init(uniwill_wmi_init);
+module_exit(uniwill_wmi_exit);
 
 MODULE_AUTHOR("TUXEDO Computers GmbH <tux@tuxedocomputers.com>");
 MODULE_DESCRIPTION("Driver for Uniwill WMI interface");
@@ -350,5 +802,50 @@ MODULE_LICENSE("GPL");
 module_param_cb(ec_direct_io, &param_ops_bool, &uniwill_ec_direct, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
 MODULE_PARM_DESC(ec_direct_io, "Do not use WMI methods to read/write EC RAM (default: true).");
 
+/*
+ * If set to true, ec_direct_io is ignored. Both transports are benchmarked
+ * at probe and the faster reliable one is used, based on rolling latency
+ * and error statistics. Failed accesses are retried on the other transport.
+ */
+module_param_cb(ec_transport_auto, &param_ops_bool, &uniwill_ec_auto, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(ec_transport_auto, "Select EC RAM transport automatically (default: false).");
+
+static int uw_ec_transport_stats_get(char *buffer, const struct kernel_param *kp)
+{
+	int t, len = 0;
+	struct uw_ec_transport_stats_t *stats;
+
+	for (t = 0; t < UW_EC_TRANSPORT_COUNT; ++t) {
+		stats = &uw_ec_transport_stats[t];
+		len += sprintf(buffer + len, "%s avg_ns=%u err_pm=%u samples=%u errors=%u\n",
+			       uw_ec_transport_names[t], stats->avg_ns, stats->err_pm,
+			       stats->samples, stats->errors);
+	}
+	len += sprintf(buffer + len, "active %s\n", uw_ec_transport_names[uw_ec_transport_best()]);
+
+	return len;
+}
+
+static const struct kernel_param_ops param_ops_ec_transport_stats = {
+	.get = uw_ec_transport_stats_get,
+};
+
+module_param_cb(ec_transport_stats, &param_ops_ec_transport_stats, NULL, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(ec_transport_stats, "Rolling EC transport statistics (read-only)");
+
+/*
+ * Learned direct EC handshake timing, for comparison between machines
+ */
+module_param_named(ec_wait_avg_ns, uw_ec_wait.avg_ns, uint, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(ec_wait_avg_ns, "Average time until EC ready flag (read-only)");
+module_param_named(ec_wait_max_ns, uw_ec_wait.max_ns, uint, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(ec_wait_max_ns, "Maximum time until EC ready flag (read-only)");
+module_param_named(ec_wait_spin_ns, uw_ec_wait.spin_ns, uint, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(ec_wait_spin_ns, "Current busy polling window (read-only)");
+module_param_named(ec_wait_sleep_us, uw_ec_wait.sleep_us, uint, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(ec_wait_sleep_us, "Current polling sleep after the busy window (read-only)");
+module_param_named(ec_wait_timeouts, uw_ec_wait.timeouts, uint, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(ec_wait_timeouts, "Number of direct EC accesses that timed out (read-only)");
+
 MODULE_DEVICE_TABLE(wmi, uniwill_wmi_device_ids);
 MODULE_ALIAS_UNIWILL_WMI();